@@ -0,0 +1,284 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+
+/*
+  Hardware performance counters for each phase of patience sort.
+
+  The counters are read with perf_event_open(2) around the deal, the
+  building of the tournament tree and the merge, by way of the phase
+  hook of the _ex sorts. If the counters cannot be opened (for
+  instance, because of /proc/sys/kernel/perf_event_paranoid, or in a
+  virtual machine), only the phase times are printed.
+
+  The phase hook is declared in patience-sort-phase-hook.h, which is
+  not installed, so build here in the source tree, against an
+  installed library, with something like
+
+    cc -O2 perf-test.c -lpatience-sort -o perf-test
+
+  and run with an optional maximum array size (default 10000000),
+  optionally followed by "huffman" to merge with the Huffman planner
+  instead of the tournament.
+
+  To see what prefetching in the merge is worth, compare against a
+  library built with CPPFLAGS=-DPATIENCE_SORT_PREFETCH_DISTANCE=0, or
+  try other distances. The effect shows at a million elements and
+  more, where the merge no longer fits in cache.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <patience-sort.h>
+#include "../patience-sort-phase-hook.h"
+
+/*------------------------------------------------------------------*/
+/* A simple linear congruential generator.                          */
+
+/* The multiplier LCG_A comes from Steele, Guy; Vigna, Sebastiano (28
+   September 2021). "Computationally easy, spectrally good multipliers
+   for congruential pseudorandom number generators".
+   arXiv:2001.05304v3 [cs.DS] */
+#define LCG_A UINT64_C(0xf1357aea2e62a9c5)
+
+/* LCG_C must be odd. */
+#define LCG_C UINT64_C(0xbaceba11beefbead)
+
+uint64_t seed = 0;
+
+static double
+random_double (void)
+{
+  /* IEEE "binary64" or "double" has 52 bits of precision. We will
+     take the high 48 bits of the seed and divide it by 2**48, to get
+     a number 0.0 <= randnum < 1.0 */
+  const double high_48_bits = (double) (seed >> 16);
+  const double divisor = (double) (UINT64_C(1) << 48);
+  const double randnum = high_48_bits / divisor;
+
+  /* The following operation is modulo 2**64, by virtue of standard C
+     behavior for uint64_t. */
+  seed = (LCG_A * seed) + LCG_C;
+
+  return randnum;
+}
+
+static int
+random_int (int m, int n)
+{
+  return m + (int) (random_double () * (n - m + 1));
+}
+
+/*------------------------------------------------------------------*/
+
+#define DEFAULT_MAX_SZ 10000000
+
+#define MAX(x, y) (((x) < (y)) ? (y) : (x))
+
+#define NUM_PHASES 3
+#define NUM_COUNTERS 4
+
+enum { INSTRUCTIONS, CYCLES, BRANCH_MISSES, LLC_MISSES };
+
+static const char *phase_names[NUM_PHASES] =
+  { "deal", "build_tree", "merge" };
+
+static const uint64_t counter_configs[NUM_COUNTERS] =
+  {
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_MISSES
+  };
+
+struct counters
+{
+  int fd[NUM_COUNTERS];
+  bool available;
+  uint64_t totals[NUM_PHASES][NUM_COUNTERS];
+};
+
+static int
+perf_event_open (struct perf_event_attr *attr, pid_t pid, int cpu,
+                 int group_fd, unsigned long flags)
+{
+  return syscall (SYS_perf_event_open, attr, pid, cpu,
+                  group_fd, flags);
+}
+
+static void
+open_counters (struct counters *c)
+{
+  memset (c, 0, sizeof (struct counters));
+  c->available = true;
+  for (int i = 0; i != NUM_COUNTERS; i += 1)
+    {
+      struct perf_event_attr attr;
+      memset (&attr, 0, sizeof (struct perf_event_attr));
+      attr.size = sizeof (struct perf_event_attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = counter_configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+      const int group_fd = (i == 0) ? -1 : c->fd[0];
+      c->fd[i] = perf_event_open (&attr, 0, -1, group_fd, 0);
+      if (c->fd[i] < 0)
+        {
+          for (int j = 0; j != i; j += 1)
+            close (c->fd[j]);
+          c->available = false;
+          return;
+        }
+    }
+}
+
+static void
+close_counters (struct counters *c)
+{
+  if (c->available)
+    for (int i = 0; i != NUM_COUNTERS; i += 1)
+      close (c->fd[i]);
+}
+
+static void
+phase_hook (enum patience_sort_phase phase, int begin, void *ctx)
+{
+  struct counters *c = ctx;
+  if (begin)
+    {
+      ioctl (c->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl (c->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+  else
+    {
+      ioctl (c->fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      uint64_t values[1 + NUM_COUNTERS];
+      if (read (c->fd[0], values, sizeof values) == sizeof values)
+        for (int i = 0; i != NUM_COUNTERS; i += 1)
+          c->totals[phase][i] += values[1 + i];
+    }
+}
+
+static int
+intcmp (const void *px, const void *py)
+{
+  const int x = *((const int *) px);
+  const int y = *((const int *) py);
+  return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+static void
+report (const char *title, size_t sz, int arr[sz])
+{
+  struct counters c;
+  open_counters (&c);
+  if (c.available)
+    patience_sort_set_phase_hook (phase_hook, &c);
+
+  int *result = malloc (sz * sizeof (int));
+  struct patience_sort_stats stats;
+  patience_sort_ex (arr, sz, sizeof (int), intcmp, result, &stats);
+  free (result);
+
+  patience_sort_set_phase_hook (NULL, NULL);
+  close_counters (&c);
+
+  const uint64_t nsec[NUM_PHASES] =
+    { stats.deal_nsec, stats.build_tree_nsec, stats.merge_nsec };
+  const double n = (double) MAX (sz, 1);
+
+  printf ("%s, size %zu, %zu piles\n", title, sz, stats.num_piles);
+  for (int i = 0; i != NUM_PHASES; i += 1)
+    {
+      printf ("  %-10s : %10.6f s", phase_names[i], nsec[i] / 1e9);
+      if (c.available)
+        {
+          const uint64_t *t = c.totals[i];
+          printf ("  %7.2f instr/elem  IPC %5.2f"
+                  "  %7.3f br-miss/elem  %7.3f LLC-miss/elem",
+                  t[INSTRUCTIONS] / n,
+                  (t[CYCLES] == 0) ? 0.0
+                  : (double) t[INSTRUCTIONS] / t[CYCLES],
+                  t[BRANCH_MISSES] / n, t[LLC_MISSES] / n);
+        }
+      printf ("\n");
+    }
+}
+
+static void
+perf_uniform_random_array (size_t sz)
+{
+  int *arr = malloc (sz * sizeof (int));
+  for (size_t i = 0; i < sz; i += 1)
+    arr[i] = random_int (1, 1000);
+  report ("Uniform random integers", sz, arr);
+  free (arr);
+}
+
+static void
+perf_ascending_array (size_t sz)
+{
+  int *arr = malloc (sz * sizeof (int));
+  for (size_t i = 0; i < sz; i += 1)
+    arr[i] = i;
+  report ("Ascending integers", sz, arr);
+  free (arr);
+}
+
+static void
+perf_descending_array (size_t sz)
+{
+  int *arr = malloc (sz * sizeof (int));
+  for (size_t i = 0; i < sz; i += 1)
+    arr[i] = -i;
+  report ("Descending integers", sz, arr);
+  free (arr);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const size_t max_sz =
+    (argc < 2) ? DEFAULT_MAX_SZ : strtoull (argv[1], NULL, 10);
+  if (3 <= argc && strcmp (argv[2], "huffman") == 0)
+    patience_sort_set_merge_planner (PATIENCE_MERGE_HUFFMAN);
+
+  struct counters c;
+  open_counters (&c);
+  if (!c.available)
+    printf ("Hardware performance counters are unavailable;"
+            " printing phase times only.\n");
+  close_counters (&c);
+
+  for (size_t sz = 1000; sz <= max_sz; sz *= 10)
+    perf_uniform_random_array (sz);
+  for (size_t sz = 1000; sz <= max_sz; sz *= 10)
+    perf_ascending_array (sz);
+  for (size_t sz = 1000; sz <= max_sz; sz *= 10)
+    perf_descending_array (sz);
+  return 0;
+}
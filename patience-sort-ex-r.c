@@ -0,0 +1,74 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <patience-sort.h>
+#include "patience-sort-phase-hook.h"
+
+/* This translation unit gathers statistics. */
+#define PATIENCE_SORT_STATS 1
+
+typedef int compar_t (const void *, const void *, void *);
+typedef uint64_t keyfn_t (const void *, void *);
+#define KEY(x, arg) key ((x), (arg))
+
+#define COMPAR(x, y, arg) \
+  (STATS_COUNT_COMPARISON (), compar ((x), (y), (arg)))
+
+#include "patience-sort.include.c"
+
+void
+patience_sort_indices_ex_r (const void *base, size_t nmemb,
+                            size_t size,
+                            int (*compar) (const void *,
+                                           const void *,
+                                           void *),
+                            void *arg, size_t *result,
+                            struct patience_sort_stats *stats)
+{
+  struct patience_sort_stats ignored;
+  stats_begin ((stats != NULL) ? stats : &ignored);
+  sort_out_of_place (base, nmemb, size, compar, NULL, arg, result, NULL);
+  stats_end ();
+}
+
+void
+patience_sort_ex_r (const void *base, size_t nmemb, size_t size,
+                    int (*compar) (const void *, const void *,
+                                   void *),
+                    void *arg, void *result,
+                    struct patience_sort_stats *stats)
+{
+  struct patience_sort_stats ignored;
+  stats_begin ((stats != NULL) ? stats : &ignored);
+  sort_out_of_place (base, nmemb, size, compar, NULL, arg, NULL, result);
+  stats_end ();
+}
+
+void
+patience_sort_in_place_ex_r (void *base, size_t nmemb, size_t size,
+                             int (*compar) (const void *, const void *,
+                                            void *),
+                             void *arg,
+                             struct patience_sort_stats *stats)
+{
+  struct patience_sort_stats ignored;
+  stats_begin ((stats != NULL) ? stats : &ignored);
+  sort_in_place (base, nmemb, size, compar, NULL, arg);
+  stats_end ();
+}
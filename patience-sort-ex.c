@@ -0,0 +1,81 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <patience-sort.h>
+#include "patience-sort-phase-hook.h"
+
+/* This translation unit gathers statistics. */
+#define PATIENCE_SORT_STATS 1
+
+typedef int compar_t (const void *, const void *);
+typedef uint64_t keyfn_t (const void *);
+#define KEY(x, arg) key ((x))
+
+#define COMPAR(x, y, arg) \
+  (STATS_COUNT_COMPARISON (), compar ((x), (y)))
+
+#include "patience-sort.include.c"
+
+_Thread_local void (*patience_sort_phase_hook) (enum patience_sort_phase,
+                                                int, void *) = NULL;
+_Thread_local void *patience_sort_phase_hook_ctx = NULL;
+
+void
+patience_sort_set_phase_hook (void (*hook) (enum patience_sort_phase,
+                                            int, void *),
+                              void *ctx)
+{
+  patience_sort_phase_hook = hook;
+  patience_sort_phase_hook_ctx = ctx;
+}
+
+void
+patience_sort_indices_ex (const void *base, size_t nmemb, size_t size,
+                          int (*compar) (const void *,
+                                         const void *),
+                          size_t *result,
+                          struct patience_sort_stats *stats)
+{
+  struct patience_sort_stats ignored;
+  stats_begin ((stats != NULL) ? stats : &ignored);
+  sort_out_of_place (base, nmemb, size, compar, NULL, NULL, result, NULL);
+  stats_end ();
+}
+
+void
+patience_sort_ex (const void *base, size_t nmemb, size_t size,
+                  int (*compar) (const void *, const void *),
+                  void *result, struct patience_sort_stats *stats)
+{
+  struct patience_sort_stats ignored;
+  stats_begin ((stats != NULL) ? stats : &ignored);
+  sort_out_of_place (base, nmemb, size, compar, NULL, NULL, NULL, result);
+  stats_end ();
+}
+
+void
+patience_sort_in_place_ex (void *base, size_t nmemb, size_t size,
+                           int (*compar) (const void *, const void *),
+                           struct patience_sort_stats *stats)
+{
+  struct patience_sort_stats ignored;
+  stats_begin ((stats != NULL) ? stats : &ignored);
+  sort_in_place (base, nmemb, size, compar, NULL, NULL);
+  stats_end ();
+}
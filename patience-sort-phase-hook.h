@@ -0,0 +1,38 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+/*
+  The phase hook of the _ex sorts, for the benchmark tools in
+  comparisons/. This header is not installed, and the hook is not
+  part of the library's interface.
+*/
+
+/* Phases of a sort, as seen by a phase hook. */
+enum patience_sort_phase
+  {
+    PATIENCE_SORT_PHASE_DEAL,
+    PATIENCE_SORT_PHASE_BUILD_TREE,
+    PATIENCE_SORT_PHASE_MERGE
+  };
+
+/* Have the _ex sorts running in the calling thread call
+   hook (phase, 1, ctx) as each phase begins and hook (phase, 0, ctx)
+   as it ends. A NULL hook removes the hook. */
+void patience_sort_set_phase_hook (void (*hook) (enum patience_sort_phase,
+                                                 int, void *),
+                                   void *ctx);
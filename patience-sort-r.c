@@ -21,6 +21,9 @@
 typedef int compar_t (const void *, const void *, void *);
 #define COMPAR(x, y, arg) compar ((x), (y), (arg))
 
+typedef uint64_t keyfn_t (const void *, void *);
+#define KEY(x, arg) key ((x), (arg))
+
 #include "patience-sort.include.c"
 
 void
@@ -30,7 +33,7 @@ patience_sort_indices_r (const void *base, size_t nmemb, size_t size,
                                         void *),
                          void *arg, size_t *result)
 {
-  sort_out_of_place (base, nmemb, size, compar, arg, result, NULL);
+  sort_out_of_place (base, nmemb, size, compar, NULL, arg, result, NULL);
 }
 
 void
@@ -39,7 +42,7 @@ patience_sort_r (const void *base, size_t nmemb, size_t size,
                                 void *),
                  void *arg, void *result)
 {
-  sort_out_of_place (base, nmemb, size, compar, arg, NULL, result);
+  sort_out_of_place (base, nmemb, size, compar, NULL, arg, NULL, result);
 }
 
 void
@@ -48,5 +51,211 @@ patience_sort_in_place_r (void *base, size_t nmemb, size_t size,
                                          void *),
                           void *arg)
 {
-  sort_in_place (base, nmemb, size, compar, arg);
+  sort_in_place (base, nmemb, size, compar, NULL, arg);
+}
+
+int
+patience_try_sort_indices_r (const void *base, size_t nmemb, size_t size,
+                             int (*compar) (const void *,
+                                            const void *,
+                                            void *),
+                             void *arg, size_t *result)
+{
+  return (try_sort_out_of_place (base, nmemb, size, compar, NULL, arg,
+                                 result, NULL)) ? 0 : ENOMEM;
+}
+
+int
+patience_try_sort_r (const void *base, size_t nmemb, size_t size,
+                     int (*compar) (const void *, const void *,
+                                    void *),
+                     void *arg, void *result)
+{
+  return (try_sort_out_of_place (base, nmemb, size, compar, NULL, arg,
+                                 NULL, result)) ? 0 : ENOMEM;
+}
+
+int
+patience_try_sort_in_place_r (void *base, size_t nmemb, size_t size,
+                              int (*compar) (const void *, const void *,
+                                             void *),
+                              void *arg)
+{
+  return (try_sort_in_place (base, nmemb, size, compar, NULL, arg)) ?
+    0 : ENOMEM;
+}
+
+void
+patience_sort_indices_keyed_r (const void *base, size_t nmemb, size_t size,
+                               int (*compar) (const void *,
+                                              const void *,
+                                              void *),
+                               uint64_t (*key) (const void *, void *),
+                               void *arg, size_t *result)
+{
+  sort_out_of_place (base, nmemb, size, compar, key, arg, result, NULL);
+}
+
+void
+patience_sort_keyed_r (const void *base, size_t nmemb, size_t size,
+                       int (*compar) (const void *, const void *,
+                                      void *),
+                       uint64_t (*key) (const void *, void *),
+                       void *arg, void *result)
+{
+  sort_out_of_place (base, nmemb, size, compar, key, arg, NULL, result);
+}
+
+void
+patience_sort_in_place_keyed_r (void *base, size_t nmemb, size_t size,
+                                int (*compar) (const void *, const void *,
+                                               void *),
+                                uint64_t (*key) (const void *, void *),
+                                void *arg)
+{
+  sort_in_place (base, nmemb, size, compar, key, arg);
+}
+
+int
+patience_is_sorted_r (const void *base, size_t nmemb, size_t size,
+                      int (*compar) (const void *, const void *,
+                                     void *),
+                      void *arg)
+{
+  return is_sorted (base, nmemb, size, compar, arg);
+}
+
+void
+patience_disorder_estimate_r (const void *base, size_t nmemb,
+                              size_t size,
+                              int (*compar) (const void *, const void *,
+                                             void *),
+                              void *arg, size_t sample_rate,
+                              struct patience_disorder *est)
+{
+  estimate_disorder (base, nmemb, size, compar, arg, sample_rate, est);
+}
+
+static void
+merge_piles (struct patience_piles *piles,
+             size_t *indices, void *elements)
+{
+  merge_dealt_piles (piles, piles->compar_r, indices, elements);
+}
+
+void
+patience_deal_r (const void *base, size_t nmemb, size_t size,
+                 int (*compar) (const void *, const void *, void *),
+                 void *arg, struct patience_piles **piles)
+{
+  *piles = deal_piles (base, nmemb, size, compar, arg);
+  (*piles)->compar_r = compar;
+  (*piles)->merge = merge_piles;
+}
+
+void
+patience_sort_batch_r (const struct patience_batch_entry *entries,
+                       size_t count,
+                       int (*compar) (const void *, const void *, void *),
+                       void *arg)
+{
+  sort_batch (entries, count, compar, arg);
+}
+
+void
+patience_sort_segmented_indices_r (const void *base, size_t size,
+                                   const size_t *offsets,
+                                   size_t nsegments,
+                                   int (*compar) (const void *,
+                                                  const void *, void *),
+                                   void *arg, size_t *result)
+{
+  sort_segments (base, size, offsets, nsegments, compar, arg,
+                 result, NULL);
+}
+
+void
+patience_sort_segmented_r (const void *base, size_t size,
+                           const size_t *offsets, size_t nsegments,
+                           int (*compar) (const void *, const void *,
+                                          void *),
+                           void *arg, void *result)
+{
+  sort_segments (base, size, offsets, nsegments, compar, arg,
+                 NULL, result);
+}
+
+void
+patience_sort_segmented_in_place_r (void *base, size_t size,
+                                    const size_t *offsets,
+                                    size_t nsegments,
+                                    int (*compar) (const void *,
+                                                   const void *, void *),
+                                    void *arg)
+{
+  sort_segments (base, size, offsets, nsegments, compar, arg,
+                 NULL, NULL);
+}
+
+void
+patience_sort_parallel_indices_r (const void *base, size_t nmemb,
+                                  size_t size,
+                                  int (*compar) (const void *,
+                                                 const void *, void *),
+                                  void *arg, size_t *result)
+{
+  sort_parallel (base, nmemb, size, compar, arg, result, NULL);
+}
+
+void
+patience_sort_parallel_r (const void *base, size_t nmemb, size_t size,
+                          int (*compar) (const void *, const void *,
+                                         void *),
+                          void *arg, void *result)
+{
+  sort_parallel (base, nmemb, size, compar, arg, NULL, result);
+}
+
+static void
+push_to_sorter (struct patience_sorter *sorter, size_t producer,
+                const void *elements, size_t nmemb)
+{
+  sorter_push (sorter, sorter->compar_r, producer, elements, nmemb);
+}
+
+static void
+drain_sorter (struct patience_sorter *sorter, void *result)
+{
+  sorter_drain (sorter, sorter->compar_r, result);
+}
+
+struct patience_sorter *
+patience_sorter_new_r (size_t size, size_t num_producers,
+                       int (*compar) (const void *, const void *,
+                                      void *),
+                       void *arg)
+{
+  struct patience_sorter *sorter = new_sorter (size, num_producers, arg);
+  sorter->compar_r = compar;
+  sorter->push = push_to_sorter;
+  sorter->drain = drain_sorter;
+  return sorter;
+}
+
+static bool
+step_job (struct patience_job *job, size_t max_elements)
+{
+  return job_step (job, job->compar_r, max_elements);
+}
+
+struct patience_job *
+patience_job_new_r (const void *base, size_t nmemb, size_t size,
+                    int (*compar) (const void *, const void *, void *),
+                    void *arg, size_t *indices, void *elements)
+{
+  struct patience_job *job =
+    new_job (base, nmemb, size, arg, indices, elements);
+  job->compar_r = compar;
+  job->step = step_job;
+  return job;
 }
@@ -17,19 +17,215 @@
 */
 
 #include <patience-sort.h>
+#if HAVE_PTHREAD_KEY_CREATE
+#include <pthread.h>
+#endif
 
 typedef int compar_t (const void *, const void *);
 #define COMPAR(x, y, arg) compar ((x), (y))
 
+typedef uint64_t keyfn_t (const void *);
+#define KEY(x, arg) key ((x))
+
 #include "patience-sort.include.c"
 
+_Thread_local size_t patience_sort_max_piles = 0;
+_Thread_local enum patience_merge_planner patience_sort_merge_planner =
+  PATIENCE_MERGE_TOURNAMENT;
+_Thread_local bool patience_sort_prefault = false;
+_Thread_local size_t patience_sort_num_threads = 1;
+_Thread_local struct allocator patience_sort_allocator = { NULL, NULL, NULL };
+
+/*
+  Each thread keeps the last few workspace buffers that its sorts gave
+  back, so that a thread doing many sorts of moderate size need not go
+  to malloc for each of them. Buffers small enough to be cached are
+  allocated in powers of two, so that those of one sort will fit the
+  next, slightly larger one. The cache is emptied when the thread
+  exits, which takes a pthread key. Without one, nothing is cached.
+*/
+
+#ifndef PATIENCE_SORT_CACHE_BUFFERS
+#define PATIENCE_SORT_CACHE_BUFFERS 8
+#endif
+
+#ifndef PATIENCE_SORT_CACHE_MAX_BYTES
+#define PATIENCE_SORT_CACHE_MAX_BYTES (4 * 1024 * 1024)
+#endif
+
+#if HAVE_PTHREAD_KEY_CREATE
+#define CACHE_LIMIT PATIENCE_SORT_CACHE_MAX_BYTES
+#else
+#define CACHE_LIMIT 0
+#endif
+
+struct workspace_cache
+{
+  size_t num_buffers;
+  void *buffers[PATIENCE_SORT_CACHE_BUFFERS]; /* The oldest first. */
+  size_t sizes[PATIENCE_SORT_CACHE_BUFFERS];
+};
+
+static _Thread_local struct workspace_cache cache;
+static _Thread_local size_t cache_max_bytes = CACHE_LIMIT;
+
+static size_t
+cache_bytes (size_t n)
+{
+  return (n <= PATIENCE_SORT_CACHE_MAX_BYTES) ? next_power_of_two (n) : n;
+}
+
+static void
+cache_empty (struct workspace_cache *c)
+{
+  for (size_t i = 0; i != c->num_buffers; i += 1)
+    free (c->buffers[i]);
+  c->num_buffers = 0;
+}
+
+#if HAVE_PTHREAD_KEY_CREATE
+
+static _Thread_local bool cache_registered = false;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static bool cache_key_made = false;
+
+static void
+cache_destroy (void *c)
+{
+  cache_empty (c);
+  cache_registered = false;
+}
+
+static void
+make_cache_key (void)
+{
+  cache_key_made = (pthread_key_create (&cache_key, cache_destroy) == 0);
+}
+
+static bool
+cache_register (void)
+{
+  /* Have the cache emptied when the thread exits. */
+  if (!cache_registered)
+    {
+      (void) pthread_once (&cache_key_once, make_cache_key);
+      cache_registered =
+        (cache_key_made && pthread_setspecific (cache_key, &cache) == 0);
+    }
+  return cache_registered;
+}
+
+#else
+
+static bool
+cache_register (void)
+{
+  return false;
+}
+
+#endif
+
+void *
+patience_sort_cache_alloc (size_t n)
+{
+  /* Take the newest buffer of the right size, if there is one. */
+  const size_t bytes = cache_bytes (n);
+  size_t i = cache.num_buffers;
+  while (i != 0 && cache.sizes[i - 1] != bytes)
+    i -= 1;
+
+  void *p;
+  if (i == 0)
+    p = malloc (bytes);
+  else
+    {
+      p = cache.buffers[i - 1];
+      for (size_t j = i; j != cache.num_buffers; j += 1)
+        {
+          cache.buffers[j - 1] = cache.buffers[j];
+          cache.sizes[j - 1] = cache.sizes[j];
+        }
+      cache.num_buffers -= 1;
+    }
+  return p;
+}
+
+void
+patience_sort_cache_free (void *p, size_t n)
+{
+  /* Keep the buffer, letting go of the oldest if the cache is full. */
+  const size_t bytes = cache_bytes (n);
+  if (bytes <= cache_max_bytes && cache_register ())
+    {
+      if (cache.num_buffers == PATIENCE_SORT_CACHE_BUFFERS)
+        {
+          free (cache.buffers[0]);
+          for (size_t j = 1; j != cache.num_buffers; j += 1)
+            {
+              cache.buffers[j - 1] = cache.buffers[j];
+              cache.sizes[j - 1] = cache.sizes[j];
+            }
+          cache.num_buffers -= 1;
+        }
+      cache.buffers[cache.num_buffers] = p;
+      cache.sizes[cache.num_buffers] = bytes;
+      cache.num_buffers += 1;
+    }
+  else
+    free (p);
+}
+
+void
+patience_sort_set_max_piles (size_t max_piles)
+{
+  patience_sort_max_piles =
+    (max_piles == 0 || 2 <= max_piles) ? max_piles : 2;
+}
+
+void
+patience_sort_set_merge_planner (enum patience_merge_planner planner)
+{
+  patience_sort_merge_planner = planner;
+}
+
+void
+patience_sort_set_prefault (int prefault)
+{
+  patience_sort_prefault = (prefault != 0);
+}
+
+void
+patience_sort_set_allocator (void *(*alloc) (size_t size, void *ctx),
+                             void (*free) (void *ptr, size_t size,
+                                           void *ctx),
+                             void *ctx)
+{
+  patience_sort_allocator.alloc = alloc;
+  patience_sort_allocator.free = free;
+  patience_sort_allocator.ctx = ctx;
+}
+
+void
+patience_sort_set_workspace_cache (size_t max_bytes)
+{
+  cache_empty (&cache);
+  cache_max_bytes = (max_bytes < CACHE_LIMIT) ? max_bytes : CACHE_LIMIT;
+}
+
+void
+patience_sort_set_num_threads (size_t num_threads)
+{
+  patience_sort_num_threads = (num_threads == 0) ? 1 : num_threads;
+}
+
 void
 patience_sort_indices (const void *base, size_t nmemb, size_t size,
                        int (*compar) (const void *,
                                       const void *),
                        size_t *result)
 {
-  sort_out_of_place (base, nmemb, size, compar, NULL, result, NULL);
+  sort_out_of_place (base, nmemb, size, compar, NULL, NULL, result, NULL);
 }
 
 void
@@ -37,12 +233,306 @@ patience_sort (const void *base, size_t nmemb, size_t size,
                int (*compar) (const void *, const void *),
                void *result)
 {
-  sort_out_of_place (base, nmemb, size, compar, NULL, NULL, result);
+  sort_out_of_place (base, nmemb, size, compar, NULL, NULL, NULL, result);
 }
 
 void
 patience_sort_in_place (void *base, size_t nmemb, size_t size,
                         int (*compar) (const void *, const void *))
 {
-  sort_in_place (base, nmemb, size, compar, NULL);
+  sort_in_place (base, nmemb, size, compar, NULL, NULL);
+}
+
+int
+patience_try_sort_indices (const void *base, size_t nmemb, size_t size,
+                           int (*compar) (const void *, const void *),
+                           size_t *result)
+{
+  return (try_sort_out_of_place (base, nmemb, size, compar, NULL, NULL,
+                                 result, NULL)) ? 0 : ENOMEM;
+}
+
+int
+patience_try_sort (const void *base, size_t nmemb, size_t size,
+                   int (*compar) (const void *, const void *),
+                   void *result)
+{
+  return (try_sort_out_of_place (base, nmemb, size, compar, NULL, NULL,
+                                 NULL, result)) ? 0 : ENOMEM;
+}
+
+int
+patience_try_sort_in_place (void *base, size_t nmemb, size_t size,
+                            int (*compar) (const void *, const void *))
+{
+  return (try_sort_in_place (base, nmemb, size, compar, NULL, NULL)) ?
+    0 : ENOMEM;
+}
+
+void
+patience_sort_indices_keyed (const void *base, size_t nmemb, size_t size,
+                             int (*compar) (const void *,
+                                            const void *),
+                             uint64_t (*key) (const void *),
+                             size_t *result)
+{
+  sort_out_of_place (base, nmemb, size, compar, key, NULL, result, NULL);
+}
+
+void
+patience_sort_keyed (const void *base, size_t nmemb, size_t size,
+                     int (*compar) (const void *, const void *),
+                     uint64_t (*key) (const void *),
+                     void *result)
+{
+  sort_out_of_place (base, nmemb, size, compar, key, NULL, NULL, result);
+}
+
+void
+patience_sort_in_place_keyed (void *base, size_t nmemb, size_t size,
+                              int (*compar) (const void *, const void *),
+                              uint64_t (*key) (const void *))
+{
+  sort_in_place (base, nmemb, size, compar, key, NULL);
+}
+
+int
+patience_is_sorted (const void *base, size_t nmemb, size_t size,
+                    int (*compar) (const void *, const void *))
+{
+  return is_sorted (base, nmemb, size, compar, NULL);
+}
+
+void
+patience_disorder_estimate (const void *base, size_t nmemb, size_t size,
+                            int (*compar) (const void *, const void *),
+                            size_t sample_rate,
+                            struct patience_disorder *est)
+{
+  estimate_disorder (base, nmemb, size, compar, NULL, sample_rate, est);
+}
+
+static void
+merge_piles (struct patience_piles *piles,
+             size_t *indices, void *elements)
+{
+  merge_dealt_piles (piles, piles->compar, indices, elements);
+}
+
+void
+patience_deal (const void *base, size_t nmemb, size_t size,
+               int (*compar) (const void *, const void *),
+               struct patience_piles **piles)
+{
+  *piles = deal_piles (base, nmemb, size, compar, NULL);
+  (*piles)->compar = compar;
+  (*piles)->merge = merge_piles;
+}
+
+size_t
+patience_piles_count (const struct patience_piles *piles)
+{
+  return piles->num_piles;
+}
+
+void
+patience_piles_lengths (const struct patience_piles *piles,
+                        size_t *lengths)
+{
+  if (piles->num_piles != 0)
+    memcpy (lengths, piles->lengths,
+            piles->num_piles * sizeof (size_t));
+}
+
+void
+patience_merge_piles (struct patience_piles *piles,
+                      size_t *indices, void *elements)
+{
+  piles->merge (piles, indices, elements);
+}
+
+void
+patience_piles_free (struct patience_piles *piles)
+{
+  if (piles != NULL)
+    {
+      const struct allocator *const a = &piles->allocator;
+      release_to (a, piles->piles, piles->num_piles * sizeof (size_t));
+      release_to (a, piles->links, piles->nmemb * sizeof (size_t));
+      release_to (a, piles->lengths, piles->num_piles * sizeof (size_t));
+      release_to (a, piles, sizeof (struct patience_piles));
+    }
+}
+
+void
+patience_sort_batch (const struct patience_batch_entry *entries,
+                     size_t count,
+                     int (*compar) (const void *, const void *))
+{
+  sort_batch (entries, count, compar, NULL);
+}
+
+void
+patience_sort_segmented_indices (const void *base, size_t size,
+                                 const size_t *offsets, size_t nsegments,
+                                 int (*compar) (const void *,
+                                                const void *),
+                                 size_t *result)
+{
+  sort_segments (base, size, offsets, nsegments, compar, NULL,
+                 result, NULL);
+}
+
+void
+patience_sort_segmented (const void *base, size_t size,
+                         const size_t *offsets, size_t nsegments,
+                         int (*compar) (const void *, const void *),
+                         void *result)
+{
+  sort_segments (base, size, offsets, nsegments, compar, NULL,
+                 NULL, result);
+}
+
+void
+patience_sort_segmented_in_place (void *base, size_t size,
+                                  const size_t *offsets,
+                                  size_t nsegments,
+                                  int (*compar) (const void *,
+                                                 const void *))
+{
+  sort_segments (base, size, offsets, nsegments, compar, NULL,
+                 NULL, NULL);
+}
+
+void
+patience_sort_parallel_indices (const void *base, size_t nmemb,
+                                size_t size,
+                                int (*compar) (const void *,
+                                               const void *),
+                                size_t *result)
+{
+  sort_parallel (base, nmemb, size, compar, NULL, result, NULL);
+}
+
+void
+patience_sort_parallel (const void *base, size_t nmemb, size_t size,
+                        int (*compar) (const void *, const void *),
+                        void *result)
+{
+  sort_parallel (base, nmemb, size, compar, NULL, NULL, result);
+}
+
+static void
+push_to_sorter (struct patience_sorter *sorter, size_t producer,
+                const void *elements, size_t nmemb)
+{
+  sorter_push (sorter, sorter->compar, producer, elements, nmemb);
+}
+
+static void
+drain_sorter (struct patience_sorter *sorter, void *result)
+{
+  sorter_drain (sorter, sorter->compar, result);
+}
+
+struct patience_sorter *
+patience_sorter_new (size_t size, size_t num_producers,
+                     int (*compar) (const void *, const void *))
+{
+  struct patience_sorter *sorter = new_sorter (size, num_producers, NULL);
+  sorter->compar = compar;
+  sorter->push = push_to_sorter;
+  sorter->drain = drain_sorter;
+  return sorter;
+}
+
+void
+patience_sorter_push (struct patience_sorter *sorter, size_t producer,
+                      const void *elements, size_t nmemb)
+{
+  sorter->push (sorter, producer, elements, nmemb);
+}
+
+size_t
+patience_sorter_count (const struct patience_sorter *sorter)
+{
+  return sorter_count (sorter);
+}
+
+void
+patience_sorter_drain (struct patience_sorter *sorter, void *result)
+{
+  sorter->drain (sorter, result);
+}
+
+void
+patience_sorter_free (struct patience_sorter *sorter)
+{
+  if (sorter != NULL)
+    {
+      const struct allocator *const a = &sorter->allocator;
+      for (size_t p = 0; p != sorter->num_producers; p += 1)
+        {
+          struct sorter_slot *slot = &sorter->slots[p];
+          release_to (a, slot->elements, slot->capacity * sorter->size);
+          release_to (a, slot->runs,
+                      slot->runs_capacity * sizeof (size_t));
+        }
+      release_to (a, sorter->slots_memory,
+                  sorter_slots_bytes (sorter->num_producers));
+      release_to (a, sorter, sizeof (struct patience_sorter));
+    }
+}
+
+static bool
+step_job (struct patience_job *job, size_t max_elements)
+{
+  return job_step (job, job->compar, max_elements);
+}
+
+struct patience_job *
+patience_job_new (const void *base, size_t nmemb, size_t size,
+                  int (*compar) (const void *, const void *),
+                  size_t *indices, void *elements)
+{
+  struct patience_job *job =
+    new_job (base, nmemb, size, NULL, indices, elements);
+  job->compar = compar;
+  job->step = step_job;
+  return job;
+}
+
+int
+patience_job_step (struct patience_job *job, size_t max_elements)
+{
+  return job->step (job, max_elements);
+}
+
+size_t
+patience_job_progress (const struct patience_job *job)
+{
+  return job->num_sorted + job->num_merged;
+}
+
+void
+patience_job_free (struct patience_job *job)
+{
+  if (job != NULL)
+    {
+      /* The workspaces go back as they were had, whatever this
+         thread's own allocator. */
+      const struct allocator previous = use_allocator (job->allocator);
+      const size_t nmemb = job->nmemb;
+      workspace_free (job->runs, nmemb * job->size);
+      workspace_free (job->places,
+                      (job->places == NULL) ? 0 : nmemb * sizeof (size_t));
+      release (job->workspace,
+               (job->workspace == NULL) ? 0 :
+               job_workspace_bytes (job_run_len (nmemb),
+                                    job->places != NULL));
+      release (job->winners,
+               job_winners_bytes (job->total_external_nodes));
+      release (job, sizeof (struct patience_job));
+      (void) use_allocator (previous);
+    }
 }
@@ -17,6 +17,7 @@
 */
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* Sorts returning indices. */
 void patience_sort_indices (const void *base,
@@ -55,3 +56,435 @@ void patience_sort_in_place_r (void *base,
                                               const void *,
                                               void *),
                                void *arg);
+
+/* Sorts that return ENOMEM, rather than exiting, if memory runs
+   out, and otherwise zero. After a failure, the result (or, for the
+   in-place sorts, the array) is left unspecified (unchanged). */
+int patience_try_sort_indices (const void *base,
+                               size_t nmemb, size_t size,
+                               int (*compar) (const void *,
+                                              const void *),
+                               size_t *result);
+int patience_try_sort_indices_r (const void *base,
+                                 size_t nmemb, size_t size,
+                                 int (*compar) (const void *,
+                                                const void *,
+                                                void *),
+                                 void *arg, size_t *result);
+int patience_try_sort (const void *base,
+                       size_t nmemb, size_t size,
+                       int (*compar) (const void *, const void *),
+                       void *result);
+int patience_try_sort_r (const void *base,
+                         size_t nmemb, size_t size,
+                         int (*compar) (const void *, const void *,
+                                        void *),
+                         void *arg, void *result);
+int patience_try_sort_in_place (void *base,
+                                size_t nmemb, size_t size,
+                                int (*compar) (const void *,
+                                               const void *));
+int patience_try_sort_in_place_r (void *base,
+                                  size_t nmemb, size_t size,
+                                  int (*compar) (const void *,
+                                                 const void *,
+                                                 void *),
+                                  void *arg);
+
+/* Sorts that are also given a key for each element. The key must
+   agree with compar: whenever key (x) < key (y), x must sort before
+   y. Elements with equal keys are ordered by compar. A key that is
+   only a prefix of the ordering, such as the first eight bytes of a
+   string, is fine. The merge compares keys where it can, which
+   saves calls of compar when there are many piles. */
+void patience_sort_indices_keyed (const void *base,
+                                  size_t nmemb, size_t size,
+                                  int (*compar) (const void *,
+                                                 const void *),
+                                  uint64_t (*key) (const void *),
+                                  size_t *result);
+void patience_sort_indices_keyed_r (const void *base,
+                                    size_t nmemb, size_t size,
+                                    int (*compar) (const void *,
+                                                   const void *,
+                                                   void *),
+                                    uint64_t (*key) (const void *,
+                                                     void *),
+                                    void *arg, size_t *result);
+void patience_sort_keyed (const void *base,
+                          size_t nmemb, size_t size,
+                          int (*compar) (const void *, const void *),
+                          uint64_t (*key) (const void *),
+                          void *result);
+void patience_sort_keyed_r (const void *base,
+                            size_t nmemb, size_t size,
+                            int (*compar) (const void *, const void *,
+                                           void *),
+                            uint64_t (*key) (const void *, void *),
+                            void *arg, void *result);
+void patience_sort_in_place_keyed (void *base,
+                                   size_t nmemb, size_t size,
+                                   int (*compar) (const void *,
+                                                  const void *),
+                                   uint64_t (*key) (const void *));
+void patience_sort_in_place_keyed_r (void *base,
+                                     size_t nmemb, size_t size,
+                                     int (*compar) (const void *,
+                                                    const void *,
+                                                    void *),
+                                     uint64_t (*key) (const void *,
+                                                      void *),
+                                     void *arg);
+
+/* Is the array in order? This stops at the first element out of
+   order. */
+int patience_is_sorted (const void *base, size_t nmemb, size_t size,
+                        int (*compar) (const void *, const void *));
+int patience_is_sorted_r (const void *base, size_t nmemb, size_t size,
+                          int (*compar) (const void *, const void *,
+                                         void *),
+                          void *arg);
+
+/* How disorderly a sample looks. The classes go by the number of
+   piles the sample deals into, which is small for data that is
+   nearly sorted and about twice the square root of the sample size
+   for random data. */
+enum patience_disorder_class
+  {
+    PATIENCE_DISORDER_SORTED,   /* In order. */
+    PATIENCE_DISORDER_REVERSED, /* In strictly reverse order. */
+    PATIENCE_DISORDER_NEARLY_SORTED, /* No more piles than
+                                        log2 (sample_size) + 1. */
+    PATIENCE_DISORDER_PARTLY_SORTED, /* No more piles than
+                                        sqrt (sample_size). */
+    PATIENCE_DISORDER_RANDOM    /* More piles than that. */
+  };
+
+struct patience_disorder
+{
+  size_t sample_size;           /* Elements in the sample. */
+  size_t num_runs;              /* Natural runs in the sample,
+                                   ascending or strictly
+                                   descending. */
+  size_t num_piles;             /* Piles the sample deals into. */
+  enum patience_disorder_class disorder_class;
+};
+
+/* Estimate the disorder of an array from every sample_rate-th
+   element (all of them, if sample_rate is 0 or 1), at the cost of
+   dealing the sample without merging it. */
+void patience_disorder_estimate (const void *base,
+                                 size_t nmemb, size_t size,
+                                 int (*compar) (const void *,
+                                                const void *),
+                                 size_t sample_rate,
+                                 struct patience_disorder *est);
+void patience_disorder_estimate_r (const void *base,
+                                   size_t nmemb, size_t size,
+                                   int (*compar) (const void *,
+                                                  const void *,
+                                                  void *),
+                                   void *arg, size_t sample_rate,
+                                   struct patience_disorder *est);
+
+/* Piles dealt but not yet merged. */
+struct patience_piles;
+
+/* Deal an array into piles, and set *piles to the result. The array
+   must stay as it is until the piles are merged. */
+void patience_deal (const void *base, size_t nmemb, size_t size,
+                    int (*compar) (const void *, const void *),
+                    struct patience_piles **piles);
+void patience_deal_r (const void *base, size_t nmemb, size_t size,
+                      int (*compar) (const void *, const void *,
+                                     void *),
+                      void *arg, struct patience_piles **piles);
+
+/* The number of piles, and their lengths, in the order the piles
+   were made. lengths must have room for patience_piles_count
+   (piles) entries. */
+size_t patience_piles_count (const struct patience_piles *piles);
+void patience_piles_lengths (const struct patience_piles *piles,
+                             size_t *lengths);
+
+/* Merge the piles into indices, or elements, or both at once; either
+   may be NULL. This uses up the piles: merging them again does
+   nothing. */
+void patience_merge_piles (struct patience_piles *piles,
+                           size_t *indices, void *elements);
+
+void patience_piles_free (struct patience_piles *piles);
+
+/* One array of a batch: nmemb elements of size bytes at base, to be
+   sorted into result, as by patience_sort. */
+struct patience_batch_entry
+{
+  const void *base;
+  size_t nmemb;
+  size_t size;
+  void *result;
+};
+
+/* Sort each of the count arrays described by entries, all by the one
+   compar. Short arrays share a workspace, and a large batch is spread
+   over as many threads as patience_sort_set_num_threads allows, so
+   compar (and arg) must then be safe to use from several threads at
+   once. The arrays are the sort's alone until it returns. */
+void patience_sort_batch (const struct patience_batch_entry *entries,
+                          size_t count,
+                          int (*compar) (const void *, const void *));
+void patience_sort_batch_r (const struct patience_batch_entry *entries,
+                            size_t count,
+                            int (*compar) (const void *, const void *,
+                                           void *),
+                            void *arg);
+
+/* Sort each segment of one array by itself. Segment i holds elements
+   offsets[i] through offsets[i + 1] - 1, so offsets has nsegments + 1
+   entries, in order. Each sorted segment goes to the same place in
+   result that it has in base, and indices are counted from the
+   beginning of the segment. Short segments share a workspace, and
+   the segments are spread over threads as by patience_sort_batch,
+   by the number of elements in them. */
+void patience_sort_segmented_indices (const void *base, size_t size,
+                                      const size_t *offsets,
+                                      size_t nsegments,
+                                      int (*compar) (const void *,
+                                                     const void *),
+                                      size_t *result);
+void patience_sort_segmented_indices_r (const void *base, size_t size,
+                                        const size_t *offsets,
+                                        size_t nsegments,
+                                        int (*compar) (const void *,
+                                                       const void *,
+                                                       void *),
+                                        void *arg, size_t *result);
+void patience_sort_segmented (const void *base, size_t size,
+                              const size_t *offsets, size_t nsegments,
+                              int (*compar) (const void *,
+                                             const void *),
+                              void *result);
+void patience_sort_segmented_r (const void *base, size_t size,
+                                const size_t *offsets, size_t nsegments,
+                                int (*compar) (const void *,
+                                               const void *, void *),
+                                void *arg, void *result);
+void patience_sort_segmented_in_place (void *base, size_t size,
+                                       const size_t *offsets,
+                                       size_t nsegments,
+                                       int (*compar) (const void *,
+                                                      const void *));
+void patience_sort_segmented_in_place_r (void *base, size_t size,
+                                         const size_t *offsets,
+                                         size_t nsegments,
+                                         int (*compar) (const void *,
+                                                        const void *,
+                                                        void *),
+                                         void *arg);
+
+/* Sort as patience_sort_indices and patience_sort do, but on as many
+   threads as patience_sort_set_num_threads allows, one for each 64K
+   or so elements. Splitters are sampled from the array, each thread
+   puts its share of the elements in buckets between the splitters,
+   and then each thread sorts one bucket into its own stretch of the
+   result. The sort is still stable. The threads sort with the calling
+   thread's settings, so compar (and arg), and any allocator, must be
+   safe to use from several threads at once. */
+void patience_sort_parallel_indices (const void *base,
+                                     size_t nmemb, size_t size,
+                                     int (*compar) (const void *,
+                                                    const void *),
+                                     size_t *result);
+void patience_sort_parallel_indices_r (const void *base,
+                                       size_t nmemb, size_t size,
+                                       int (*compar) (const void *,
+                                                      const void *,
+                                                      void *),
+                                       void *arg, size_t *result);
+void patience_sort_parallel (const void *base,
+                             size_t nmemb, size_t size,
+                             int (*compar) (const void *,
+                                            const void *),
+                             void *result);
+void patience_sort_parallel_r (const void *base,
+                               size_t nmemb, size_t size,
+                               int (*compar) (const void *,
+                                              const void *, void *),
+                               void *arg, void *result);
+
+/* A sorter, for elements that come from several producer threads at
+   once. Each producer, numbered from 0 to num_producers - 1, pushes
+   to its own slot, which no other thread may push to, and so pushing
+   takes no locks. The producers sort what they push as they go, a
+   stretch at a time. A drain, when no producer is pushing, merges the
+   sorted stretches of all the producers into result, which must have
+   room for patience_sorter_count elements, and empties the sorter
+   for reuse. Equal elements come out by producer, and then in the
+   order they were pushed, so that the result does not depend on how
+   the producers' threads were scheduled. The sorter allocates with
+   the allocator of the thread that made it, which must then be safe
+   to use from the producers' threads. */
+struct patience_sorter;
+struct patience_sorter *
+patience_sorter_new (size_t size, size_t num_producers,
+                     int (*compar) (const void *, const void *));
+struct patience_sorter *
+patience_sorter_new_r (size_t size, size_t num_producers,
+                       int (*compar) (const void *, const void *,
+                                      void *),
+                       void *arg);
+void patience_sorter_push (struct patience_sorter *sorter,
+                           size_t producer,
+                           const void *elements, size_t nmemb);
+size_t patience_sorter_count (const struct patience_sorter *sorter);
+void patience_sorter_drain (struct patience_sorter *sorter,
+                            void *result);
+void patience_sorter_free (struct patience_sorter *sorter);
+
+/* A job sorts an array a slice at a time, for a thread, such as an
+   event loop, that cannot wait for the whole sort. The result goes
+   to indices, or elements, or both at once; either may be NULL. Each
+   patience_job_step does about max_elements elements' worth of work,
+   though never less than the job can do in one go (a run of a few
+   thousand elements, while runs are being sorted), and returns
+   nonzero once the result is complete. patience_job_progress tells
+   how much work has been done, out of 2 * nmemb. The array and the
+   result are the job's until it is freed, and freeing a job before
+   it is done cancels it, leaving the result unspecified. A job is
+   allocated all at once when it is made, with the allocator of the
+   thread that made it, and its steps allocate nothing, so that they
+   cannot run out of memory. */
+struct patience_job;
+struct patience_job *
+patience_job_new (const void *base, size_t nmemb, size_t size,
+                  int (*compar) (const void *, const void *),
+                  size_t *indices, void *elements);
+struct patience_job *
+patience_job_new_r (const void *base, size_t nmemb, size_t size,
+                    int (*compar) (const void *, const void *, void *),
+                    void *arg, size_t *indices, void *elements);
+int patience_job_step (struct patience_job *job, size_t max_elements);
+size_t patience_job_progress (const struct patience_job *job);
+void patience_job_free (struct patience_job *job);
+
+/* Have sorts in the calling thread deal into no more than max_piles
+   piles at a time, merging each lot of piles into a run and then
+   merging the runs. This keeps the searches and the merge tree small
+   on random data, and changes nothing for data that needs no more
+   piles than that. Zero, the default, means no cap; a cap of 1 is
+   taken as 2. */
+void patience_sort_set_max_piles (size_t max_piles);
+
+/* How sorts in the calling thread merge many piles. The tournament,
+   the default, merges all the piles at once. The Huffman planner
+   merges them two at a time, always the two shortest, so that the
+   elements of long piles take part in fewer comparisons. */
+enum patience_merge_planner
+  {
+    PATIENCE_MERGE_TOURNAMENT,
+    PATIENCE_MERGE_HUFFMAN
+  };
+void patience_sort_set_merge_planner (enum patience_merge_planner
+                                      planner);
+
+/* Have sorts in the calling thread fault in their large workspaces
+   when they are allocated (if prefault is nonzero), so that the cost
+   of the page faults is not paid during the merge. Large workspaces
+   are put in huge pages when the system allows it, either way. The
+   default is not to pre-fault. */
+void patience_sort_set_prefault (int prefault);
+
+/* Have sorts in the calling thread, and piles dealt in it, get their
+   memory from alloc and give it back to free, with ctx as the last
+   argument of each. free is also told the size that was asked for,
+   which suits an arena that frees everything at once and ignores
+   free. An alloc that returns NULL makes the patience_try_ sorts
+   return ENOMEM; the other entry points exit. If alloc is NULL,
+   malloc and free are used, which is the default. Large workspaces
+   come from alloc, not from huge pages, while an allocator is
+   set. */
+void patience_sort_set_allocator (void *(*alloc) (size_t size,
+                                                  void *ctx),
+                                  void (*free) (void *ptr, size_t size,
+                                                void *ctx),
+                                  void *ctx);
+
+/* Keep, in the calling thread, workspace buffers of up to max_bytes
+   that its sorts have finished with, so that later sorts of a similar
+   size can have them without going to malloc. The last few buffers
+   are kept, until the thread exits. The default is 4 MiB, which is
+   also the most allowed; zero turns the cache off. Either way, what
+   is cached now is freed. Nothing is cached on systems without
+   POSIX threads, nor while an allocator is set. */
+void patience_sort_set_workspace_cache (size_t max_bytes);
+
+/* Let a batch, a segmented sort, or a parallel sort, in the calling
+   thread use up to num_threads threads, counting the calling thread.
+   Other threads are started only when there is enough work for them,
+   and they sort with the calling thread's settings. The default is 1,
+   which is also what 0 means. Without POSIX threads, only the calling
+   thread is used. */
+void patience_sort_set_num_threads (size_t num_threads);
+
+/* Statistics reported by the "_ex" sorts. The ordinary entry points
+   do not gather statistics and pay nothing for their existence. */
+struct patience_sort_stats
+{
+  size_t num_piles;             /* Piles made by the deal. */
+  size_t num_conses;            /* Elements consed onto a pile. */
+  size_t num_appends;           /* Elements appended to a pile. */
+  size_t num_new_piles;         /* Elements that started a pile. */
+  size_t num_undealt;           /* Elements left undealt when the
+                                   data proved too disorderly for
+                                   piles, and was merge sorted. */
+  size_t num_distinct;          /* Different values, when there
+                                   were few enough for equal values
+                                   to be grouped instead of dealt;
+                                   otherwise zero. */
+  size_t deal_comparisons;      /* Calls of compar while dealing. */
+  size_t merge_comparisons;     /* Calls of compar while merging. */
+  size_t tournament_size;       /* External nodes of the tree, if
+                                   there was a tree. */
+  size_t bytes_allocated;       /* Workspace taken from the heap. */
+  uint64_t deal_nsec;           /* Time spent dealing. */
+  uint64_t build_tree_nsec;     /* Time spent building the tree. */
+  uint64_t merge_nsec;          /* Time spent merging. */
+};
+
+/* Sorts that also fill in *stats, if stats is not NULL. */
+void patience_sort_indices_ex (const void *base,
+                               size_t nmemb, size_t size,
+                               int (*compar) (const void *,
+                                              const void *),
+                               size_t *result,
+                               struct patience_sort_stats *stats);
+void patience_sort_indices_ex_r (const void *base,
+                                 size_t nmemb, size_t size,
+                                 int (*compar) (const void *,
+                                                const void *,
+                                                void *),
+                                 void *arg, size_t *result,
+                                 struct patience_sort_stats *stats);
+void patience_sort_ex (const void *base,
+                       size_t nmemb, size_t size,
+                       int (*compar) (const void *, const void *),
+                       void *result,
+                       struct patience_sort_stats *stats);
+void patience_sort_ex_r (const void *base,
+                         size_t nmemb, size_t size,
+                         int (*compar) (const void *, const void *,
+                                        void *),
+                         void *arg, void *result,
+                         struct patience_sort_stats *stats);
+void patience_sort_in_place_ex (void *base,
+                                size_t nmemb, size_t size,
+                                int (*compar) (const void *,
+                                               const void *),
+                                struct patience_sort_stats *stats);
+void patience_sort_in_place_ex_r (void *base,
+                                  size_t nmemb, size_t size,
+                                  int (*compar) (const void *,
+                                                 const void *,
+                                                 void *),
+                                  void *arg,
+                                  struct patience_sort_stats *stats);
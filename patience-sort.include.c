@@ -18,8 +18,24 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#if HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #define LINK_NIL ((size_t) 0)
 #define VALUE 0
@@ -30,6 +46,197 @@
 #define LINKS_SIZE      LEN_THRESHOLD
 #define WORKSPACE_SIZE  (4 * LEN_THRESHOLD)
 
+/* The pile descriptors of a deal begin with room for this many piles,
+   and the room is doubled whenever it runs out. */
+#define INITIAL_PILES   64
+
+/* What the deal returns if it runs out of memory. */
+#define DEAL_FAILED     SIZE_MAX
+
+/* How many times in a row one pile must win before the merge
+   gallops. */
+#define MIN_GALLOP      7
+
+/* Up to this many piles are merged without a tournament tree. */
+#define SMALL_K_MAX     8
+
+/* Once the deal has made this many piles, and more than the square
+   root of the number of elements dealt, the data is taken to be too
+   disorderly for piles, and is merge sorted instead, unless the
+   elements are larger than MERGE_SORT_COPY_MAX and there are no
+   keys. The merge sort goes by the keys too, in keyed sorts. This
+   test is also why random data of small elements never reaches the
+   blocked tree (see PATIENCE_SORT_BLOCKED_TREE_MIN_PILES) or the
+   keyed tree: those serve data that makes many piles and still
+   passes it. */
+#define ADAPTIVE_MIN_PILES 64
+
+/* Data with no more than this many different values is sorted by
+   grouping equal values, if there are at least FEW_DISTINCT_MIN_NMEMB
+   elements and the data does not begin in order (see
+   group_by_value). */
+#define FEW_DISTINCT_MAX        1024
+#define FEW_DISTINCT_MIN_NMEMB  (8 * FEW_DISTINCT_MAX)
+
+/* The merge sort begins with insertion-sorted runs of this length. */
+#define MERGE_SORT_RUN  16
+
+/* The merge sort carries copies of elements of up to this many bytes
+   in its records. Larger elements are sorted by their indices, so
+   that the workspace goes by the number of elements alone. */
+#define MERGE_SORT_COPY_MAX  (4 * sizeof (size_t))
+
+/* From this many piles up, the tournament tree is laid out in
+   cache-line blocks. Keyed sorts use their own tree however many
+   piles there are, and data disorderly enough to make this many
+   piles quickly is merge sorted instead (see ADAPTIVE_MIN_PILES). */
+#ifndef PATIENCE_SORT_BLOCKED_TREE_MIN_PILES
+#define PATIENCE_SORT_BLOCKED_TREE_MIN_PILES 1024
+#endif
+
+/* How far along a pile, in elements, the tournament merge
+   prefetches. Zero turns prefetching off. */
+#ifndef PATIENCE_SORT_PREFETCH_DISTANCE
+#define PATIENCE_SORT_PREFETCH_DISTANCE 1
+#endif
+
+/* Sorted output of at least this many bytes, which is taken to be
+   well beyond the last level of cache, is written with non-temporal
+   stores, where there are any. */
+#ifndef PATIENCE_SORT_STREAM_MIN_BYTES
+#define PATIENCE_SORT_STREAM_MIN_BYTES (32 * 1024 * 1024)
+#endif
+
+/* Workspaces of at least this many bytes are mapped in huge pages,
+   where the system has them. */
+#ifndef PATIENCE_SORT_HUGE_PAGE_MIN_BYTES
+#define PATIENCE_SORT_HUGE_PAGE_MIN_BYTES (4 * 1024 * 1024)
+#endif
+
+/* Huge page mappings are made in multiples of this, and explicit
+   huge pages are asked for in this size, whatever the system's
+   default. */
+#define HUGE_PAGE_SHIFT 21
+#define HUGE_PAGE_BYTES ((size_t) 1 << HUGE_PAGE_SHIFT)
+
+/* The size of the staging buffer for non-temporal output. */
+#define STAGE_BYTES     4096
+
+#if defined __GNUC__
+#define PREFETCH(p) __builtin_prefetch ((p))
+#else
+#define PREFETCH(p) ((void) (p))
+#endif
+
+/* The cap on piles set by patience_sort_set_max_piles, or zero for no
+   cap, the merge planner set by patience_sort_set_merge_planner,
+   whether large workspaces are pre-faulted, as set by
+   patience_sort_set_prefault, and the most threads a sort may use, as
+   set by patience_sort_set_num_threads. They are defined in
+   patience-sort.c. */
+extern _Thread_local size_t patience_sort_max_piles;
+extern _Thread_local enum patience_merge_planner
+  patience_sort_merge_planner;
+extern _Thread_local bool patience_sort_prefault;
+extern _Thread_local size_t patience_sort_num_threads;
+
+/* Where sorts get their memory. If alloc is NULL, it is malloc and
+   free. */
+struct allocator
+{
+  void *(*alloc) (size_t size, void *ctx);
+  void (*free) (void *ptr, size_t size, void *ctx);
+  void *ctx;
+};
+
+/* The allocator set by patience_sort_set_allocator. It is defined in
+   patience-sort.c. */
+extern _Thread_local struct allocator patience_sort_allocator;
+
+/* The calling thread's cache of workspace buffers, which is kept in
+   patience-sort.c. Memory that would come from malloc comes through
+   it instead, and a buffer given back may be kept for the next sort
+   in the thread. */
+extern void *patience_sort_cache_alloc (size_t n);
+extern void patience_sort_cache_free (void *p, size_t n);
+
+/*
+  Statistics are gathered only in translation units that define
+  PATIENCE_SORT_STATS to 1 before including this file. Elsewhere the
+  STATS macros expand to nothing at all.
+*/
+
+#ifndef PATIENCE_SORT_STATS
+#define PATIENCE_SORT_STATS 0
+#endif
+
+#if PATIENCE_SORT_STATS
+
+#include <time.h>
+
+/* The phase hook is defined in patience-sort-ex.c. */
+extern _Thread_local void (*patience_sort_phase_hook)
+  (enum patience_sort_phase, int, void *);
+extern _Thread_local void *patience_sort_phase_hook_ctx;
+
+static _Thread_local struct patience_sort_stats *current_stats;
+static _Thread_local size_t *stats_comparisons;
+static _Thread_local struct timespec stats_phase_start;
+
+static void
+stats_begin (struct patience_sort_stats *s)
+{
+  memset (s, 0, sizeof (struct patience_sort_stats));
+  current_stats = s;
+  stats_comparisons = &s->deal_comparisons;
+}
+
+static void
+stats_end (void)
+{
+  current_stats = NULL;
+  stats_comparisons = NULL;
+}
+
+static void
+stats_phase_begin (enum patience_sort_phase phase, size_t *comparisons)
+{
+  if (patience_sort_phase_hook != NULL)
+    patience_sort_phase_hook (phase, 1, patience_sort_phase_hook_ctx);
+  stats_comparisons = comparisons;
+  clock_gettime (CLOCK_MONOTONIC, &stats_phase_start);
+}
+
+static void
+stats_phase_end (enum patience_sort_phase phase, uint64_t *nsec)
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  *nsec += ((uint64_t) (t.tv_sec - stats_phase_start.tv_sec)
+            * UINT64_C (1000000000))
+    + (uint64_t) t.tv_nsec - (uint64_t) stats_phase_start.tv_nsec;
+  if (patience_sort_phase_hook != NULL)
+    patience_sort_phase_hook (phase, 0, patience_sort_phase_hook_ctx);
+}
+
+#define STATS_ADD(FIELD, N) (current_stats->FIELD += (N))
+#define STATS_SET(FIELD, X) (current_stats->FIELD = (X))
+#define STATS_COUNT_COMPARISON() (*stats_comparisons += 1)
+#define STATS_PHASE_BEGIN(PHASE, COMPARISONS) \
+  stats_phase_begin ((PHASE), &current_stats->COMPARISONS)
+#define STATS_PHASE_END(PHASE, NSEC) \
+  stats_phase_end ((PHASE), &current_stats->NSEC)
+
+#else
+
+#define STATS_ADD(FIELD, N) ((void) 0)
+#define STATS_SET(FIELD, X) ((void) 0)
+#define STATS_COUNT_COMPARISON() ((void) 0)
+#define STATS_PHASE_BEGIN(PHASE, COMPARISONS) ((void) 0)
+#define STATS_PHASE_END(PHASE, NSEC) ((void) 0)
+
+#endif
+
 static size_t
 next_power_of_two (size_t i)
 {
@@ -40,9 +247,232 @@ next_power_of_two (size_t i)
   return j;
 }
 
+static inline bool
+beats (const void *base, size_t size, compar_t *compar, void *arg,
+       size_t i, size_t opponent)
+{
+  /* Does element i come before the opponent? Everything beats
+     LINK_NIL. */
+  bool result;
+  if (opponent == LINK_NIL)
+    result = true;
+  else
+    {
+      const size_t i1 = opponent - 1;
+      const size_t i2 = i - 1;
+      const int cmp = COMPAR (((char *) base) + i2 * size,
+                              ((char *) base) + i1 * size,
+                              arg);
+      result = ((cmp < 0) | ((cmp == 0) & (i2 < i1)));
+    }
+  return result;
+}
+
+/*
+  Memory is had from the calling thread's allocator, and given back
+  with its size, which an arena allocator may want. Without an
+  allocator, it is had through the thread's cache. A NULL result means
+  the memory could not be had: the sort then frees what it has and
+  reports the failure, rather than exiting.
+*/
+
+static void *
+allocate (size_t n)
+{
+  const struct allocator *const a = &patience_sort_allocator;
+  void *p = ((a->alloc != NULL) ?
+             a->alloc (n, a->ctx) : patience_sort_cache_alloc (n));
+  if (p != NULL)
+    STATS_ADD (bytes_allocated, n);
+  return p;
+}
+
+static void
+release_to (const struct allocator *a, void *p, size_t n)
+{
+  if (p == NULL)
+    {
+      /* Nothing to give back. */
+    }
+  else if (a->alloc != NULL)
+    a->free (p, n, a->ctx);
+  else
+    patience_sort_cache_free (p, n);
+}
+
+static void
+release (void *p, size_t n)
+{
+  release_to (&patience_sort_allocator, p, n);
+}
+
+static void
+exit_if_out_of_memory (bool ok)
+{
+  /* The entry points that cannot report a failure keep the old
+     behavior. */
+  if (!ok)
+    {
+      /* LCOV_EXCL_START */
+      fprintf (stderr, "Memory exhausted while sorting.\n");
+      exit (1);
+      /* LCOV_EXCL_STOP */
+    }
+}
+
+#if HAVE_SYS_MMAN_H && defined MAP_ANONYMOUS
+
+static size_t
+workspace_mapping_bytes (size_t n)
+{
+  return (n + (HUGE_PAGE_BYTES - 1)) & ~(size_t) (HUGE_PAGE_BYTES - 1);
+}
+
+static void
+workspace_prefault (char *p, size_t bytes, bool huge)
+{
+  /* Have the kernel fault the pages in, if it can. Otherwise write a
+     byte to each page: where the advice for huge pages did not take,
+     the pages may be as small as 4 KiB. */
+#if defined MADV_POPULATE_WRITE
+  if (madvise (p, bytes, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+  const size_t step = huge ? HUGE_PAGE_BYTES : 4096;
+  for (size_t i = 0; i < bytes; i += step)
+    ((volatile char *) p)[i] = 0;
+}
+
+static void *
+workspace_alloc (size_t n)
+{
+  /*
+    A workspace big enough to be walked at random, such as the links,
+    costs a TLB miss at nearly every step if it is in small pages. Ask
+    for explicit huge pages first. Failing that, which is usual when
+    none have been reserved, ask for transparent huge pages. If
+    patience_sort_prefault is set, have the pages faulted in now,
+    rather than during the merge. For transparent huge pages that must
+    wait until the advice is given, or the pages would be faulted in
+    small.
+  */
+
+  void *p;
+  if (n < PATIENCE_SORT_HUGE_PAGE_MIN_BYTES
+      || patience_sort_allocator.alloc != NULL)
+    p = allocate (n);
+  else
+    {
+      const size_t bytes = workspace_mapping_bytes (n);
+      const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+      /* A hugetlb mapping can be unmapped only in whole pages, so
+         name the page size the mapping is rounded to: the default
+         may be larger. Where the size cannot be named, use only
+         transparent huge pages. */
+      p = MAP_FAILED;
+#if defined MAP_HUGETLB && defined MAP_HUGE_SHIFT
+      int populate = 0;
+#if defined MAP_POPULATE
+      if (patience_sort_prefault)
+        populate = MAP_POPULATE;
+#endif
+      p = mmap (NULL, bytes, PROT_READ | PROT_WRITE,
+                flags | populate | MAP_HUGETLB
+                | (HUGE_PAGE_SHIFT << MAP_HUGE_SHIFT), -1, 0);
+#endif
+      if (p == MAP_FAILED)
+        {
+          p = mmap (NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+          if (p != MAP_FAILED)
+            {
+              /* The advice fails where transparent huge pages are
+                 not available; the mapping is then in small pages. */
+              bool huge = false;
+#if defined MADV_HUGEPAGE
+              huge = (madvise (p, bytes, MADV_HUGEPAGE) == 0);
+#endif
+              if (patience_sort_prefault)
+                workspace_prefault (p, bytes, huge);
+            }
+        }
+      if (p == MAP_FAILED)
+        p = NULL;
+      else
+        STATS_ADD (bytes_allocated, n);
+    }
+  return p;
+}
+
+static void
+workspace_free (void *p, size_t n)
+{
+  if (n < PATIENCE_SORT_HUGE_PAGE_MIN_BYTES
+      || patience_sort_allocator.alloc != NULL)
+    release (p, n);
+  else if (p != NULL)
+    (void) munmap (p, workspace_mapping_bytes (n));
+}
+
+#else
+
+static void *
+workspace_alloc (size_t n)
+{
+  return allocate (n);
+}
+
+static void
+workspace_free (void *p, size_t n)
+{
+  release (p, n);
+}
+
+#endif
+
+/*
+  A pile, as the deal sees it: its first and last elements, which are
+  what the searches of the deal compare against, and its length. They
+  are kept together, so that the deal touches only one place in
+  memory for each pile it looks at.
+*/
+struct pile
+{
+  size_t head;                  /* The first element. */
+  size_t tail;                  /* The last element. */
+  size_t length;                /* How many elements. */
+};
+
+static bool
+grow_piles (struct pile **piles, size_t *capacity)
+{
+  /* Double the room for pile descriptors. Return false, leaving the
+     descriptors as they were, if there is no memory for it. */
+  const size_t old_capacity = *capacity;
+  const size_t new_capacity =
+    (old_capacity == 0) ? INITIAL_PILES : 2 * old_capacity;
+  struct pile *p = allocate (new_capacity * sizeof (struct pile));
+  if (p != NULL)
+    {
+      if (old_capacity != 0)
+        memcpy (p, *piles, old_capacity * sizeof (struct pile));
+      release (*piles, old_capacity * sizeof (struct pile));
+      *piles = p;
+      *capacity = new_capacity;
+    }
+  return (p != NULL);
+}
+
+static void
+pile_heads (size_t num_piles, const struct pile *piles, size_t *heads)
+{
+  for (size_t i = 0; i != num_piles; i += 1)
+    heads[i] = piles[i].head;
+}
+
 static inline size_t
 find_pile (const void *base, size_t size, compar_t *compar,
-           void *arg, size_t num_piles, const size_t *piles,
+           void *arg, size_t num_piles, const struct pile *piles,
            size_t q)
 {
   /*
@@ -51,6 +481,8 @@ find_pile (const void *base, size_t size, compar_t *compar,
     Bottenbruch search for the *leftmost* pile whose *first* element
     is *greater* than or equal to the next value dealt by "deal".
 
+    The first elements of the piles are in increasing order.
+
     References:
 
       * H. Bottenbruch, "Structure and use of ALGOL 60", Journal of
@@ -74,13 +506,8 @@ find_pile (const void *base, size_t size, compar_t *compar,
       size_t k = num_piles - 1;
       while (j != k)
         {
-          const size_t i1 = q - 1;
-          const size_t i2 = piles[j] - 1;
-          const int cmp = COMPAR (((char *) base) + i2 * size,
-                                  ((char *) base) + i1 * size,
-                                  arg);
           const size_t i = j + ((k - j) >> 1);
-          if ((cmp < 0) | ((cmp == 0) & (i2 < i1)))
+          if (beats (base, size, compar, arg, piles[i].head, q))
             j = i + 1;
           else
             k = i;
@@ -88,18 +515,10 @@ find_pile (const void *base, size_t size, compar_t *compar,
 
       if (j + 1 != num_piles)
         retval = j + 1;
+      else if (beats (base, size, compar, arg, piles[j].head, q))
+        retval = num_piles + 1;
       else
-        {
-          const size_t i1 = q - 1;
-          const size_t i2 = piles[j] - 1;
-          const int cmp = COMPAR (((char *) base) + i2 * size,
-                                  ((char *) base) + i1 * size,
-                                  arg);
-          if ((cmp < 0) | ((cmp == 0) & (i2 < i1)))
-            retval = num_piles + 1;
-          else
-            retval = num_piles;
-        }
+        retval = num_piles;
     }
 
   return retval;
@@ -107,15 +526,17 @@ find_pile (const void *base, size_t size, compar_t *compar,
 
 static inline size_t
 find_last_elem (const void *base, size_t size, compar_t *compar,
-                void *arg, size_t num_piles, const size_t *last_elems,
+                void *arg, size_t num_piles, const struct pile *piles,
                 size_t q)
 {
   /*
     ------------------------------------------------------------------
 
-    Bottenbruch search for the *rightmost* pile whose *last* element
+    Bottenbruch search for the *leftmost* pile whose *last* element
     is *less* than or equal to the next value dealt by "deal".
 
+    The last elements of the piles are in decreasing order.
+
     References:
 
       * H. Bottenbruch, "Structure and use of ALGOL 60", Journal of
@@ -139,42 +560,101 @@ find_last_elem (const void *base, size_t size, compar_t *compar,
       size_t k = num_piles - 1;
       while (j != k)
         {
-          const size_t i1 = q - 1;
-          const size_t i2 = last_elems[num_piles - 1 - j] - 1;
-          const int cmp = COMPAR ((char *) base + i1 * size,
-                                  (char *) base + i2 * size,
-                                  arg);
           const size_t i = j + ((k - j) >> 1);
-          if ((cmp < 0) | ((cmp == 0) & (i1 < i2)))
+          if (beats (base, size, compar, arg, q, piles[i].tail))
             j = i + 1;
           else
             k = i;
         }
 
       if (j + 1 != num_piles)
-        retval = num_piles - j;
+        retval = j + 1;
+      else if (beats (base, size, compar, arg, q, piles[j].tail))
+        retval = num_piles + 1;
       else
-        {
-          const size_t i1 = q - 1;
-          const size_t i2 = last_elems[num_piles - 1 - j] - 1;
-          const int cmp = COMPAR ((char *) base + i1 * size,
-                                  (char *) base + i2 * size,
-                                  arg);
-          if ((cmp < 0) | ((cmp == 0) & (i1 < i2)))
-            retval = num_piles + 1;
-          else
-            retval = 1;
-        }
+        retval = num_piles;
     }
 
   return retval;
 }
 
-static void
+static size_t
+find_run (const void *base, size_t size, compar_t *compar,
+          void *arg, size_t q, bool *ascending)
+{
+  /* Find the natural run that ends at q: either ascending, or
+     strictly descending. Return the start of the run. */
+  size_t r = q;
+  if (q != 1)
+    {
+      *ascending = beats (base, size, compar, arg, q - 1, q);
+      r = q - 1;
+      while (r != 1
+             && beats (base, size, compar, arg, r - 1, r) == *ascending)
+        r -= 1;
+    }
+  return r;
+}
+
+static size_t
+count_fitting (const void *base, size_t size, compar_t *compar,
+               void *arg, size_t first, size_t len, size_t bound,
+               bool ascending)
+{
+  /*
+    Count how many of first, first - 1, first - 2, ... (but no more
+    than len of them) lie beyond the bound: above it, if the run is
+    ascending, or below it, if the run is descending. Those that do
+    form an initial segment, which is found by exponential search.
+  */
+
+  size_t fit = 0;
+  size_t step = 1;
+  bool done = (len == 0);
+  while (!done)
+    {
+      size_t target = fit + step - 1;
+      if (len <= target)
+        target = len - 1;
+      const bool fits =
+        (ascending) ?
+        beats (base, size, compar, arg, bound, first - target) :
+        beats (base, size, compar, arg, first - target, bound);
+      if (fits)
+        {
+          fit = target + 1;
+          done = (fit == len);
+          step += step;
+        }
+      else
+        {
+          size_t lo = fit;
+          size_t hi = target;
+          while (lo != hi)
+            {
+              const size_t mid = lo + ((hi - lo) >> 1);
+              const bool mid_fits =
+                (ascending) ?
+                beats (base, size, compar, arg, bound, first - mid) :
+                beats (base, size, compar, arg, first - mid, bound);
+              if (mid_fits)
+                lo = mid + 1;
+              else
+                hi = mid;
+            }
+          fit = lo;
+          done = true;
+        }
+    }
+  return fit;
+}
+
+static size_t
 patience_sort_deal (const void *base, size_t nmemb, size_t size,
-                    compar_t *compar, void *arg, size_t *num_piles,
-                    size_t *piles, size_t *links,
-                    size_t *last_elems, size_t *tails)
+                    compar_t *compar, void *arg, size_t max_piles,
+                    bool adaptive, size_t *num_piles,
+                    struct pile **piles, size_t *capacity,
+                    size_t *links)
 {
   /*
 
@@ -191,45 +671,142 @@ patience_sort_deal (const void *base, size_t nmemb, size_t size,
     already sorted in the desired order will result in a single pile
     with just consing.
 
+    The array is dealt a natural run at a time, as timsort finds
+    them. Once an element of an ascending run has been put at the
+    beginning of a pile, the elements before it in the run go to the
+    same pile for as long as they stay above the beginning of the
+    pile to its left. Likewise, once an element of a descending run
+    has been put at the end of a pile, the elements before it go to
+    the same pile for as long as they stay below the end of the pile
+    to its left. Those elements are found by one search within the
+    run, and the piles come out the same as if each had been dealt
+    by itself.
+
+    Elements nmemb, nmemb - 1, nmemb - 2, ... are dealt, until either
+    they run out or an element would start pile max_piles + 1. If
+    adaptive is true, the deal also stops when an element would start
+    a pile and the piles have grown too many (see ADAPTIVE_MIN_PILES).
+    The return value is the number of elements left undealt. Only the
+    descriptors of the piles made, and the links of the elements
+    dealt, are written. The *piles array has room for *capacity
+    descriptors; if it fills up, it is taken to be from allocate, and
+    is grown. (A caller with an array of its own gives it room for
+    every pile there might be.) If there is no memory to grow it, the
+    return value is DEAL_FAILED instead.
+
   */
 
-  memset (piles, LINK_NIL, nmemb * sizeof (size_t));
-  memset (links, LINK_NIL, nmemb * sizeof (size_t));
-  memset (last_elems, LINK_NIL, nmemb * sizeof (size_t));
-  memset (tails, LINK_NIL, nmemb * sizeof (size_t));
+  struct pile *p = *piles;
   size_t m = 0;
 
-  for (size_t q = nmemb; q != 0; q -= 1)
+  size_t r = nmemb + 1;         /* The start of the current run. */
+  bool ascending = true;
+
+  size_t q = nmemb;
+  bool full = false;
+  bool out_of_memory = false;
+  while (q != 0 && !full)
     {
-      const size_t i = find_pile (base, size, compar, arg,
-                                  m, piles, q);
+      if (q < r)
+        r = find_run (base, size, compar, arg, q, &ascending);
+
+      size_t placed_at;         /* The pile q went to. */
+      bool at_beginning;        /* Whether q began that pile. */
+      bool at_end;              /* Whether q ended that pile. */
+
+      const size_t i = find_pile (base, size, compar, arg, m, p, q);
       if (i == m + 1)
         {
           const size_t i = find_last_elem (base, size, compar, arg,
-                                           m, last_elems, q);
-          if (i == m + 1)
+                                           m, p, q);
+          if (i == m + 1
+              && (m == max_piles
+                  || (adaptive && ADAPTIVE_MIN_PILES <= m
+                      && nmemb - q < m * m)))
+            full = true;
+          else if (i == m + 1 && m == *capacity
+                   && !grow_piles (piles, capacity))
+            {
+              full = true;
+              out_of_memory = true;
+            }
+          else if (i == m + 1)
             {                   /* Start a new pile. */
-              piles[m] = q;
-              last_elems[m] = q;
-              tails[m] = q;
+              p = *piles;
+              links[q - 1] = LINK_NIL;
+              p[m].head = q;
+              p[m].tail = q;
+              p[m].length = 0;
               m += 1;
+              STATS_ADD (num_new_piles, 1);
+              placed_at = i;
+              at_beginning = true;
+              at_end = true;
             }
           else
             {                   /* Append to the end of a pile. */
-              const size_t i0 = tails[i - 1];
-              links[i0 - 1] = q;
-              last_elems[i - 1] = q;
-              tails[i - 1] = q;
+              links[p[i - 1].tail - 1] = q;
+              links[q - 1] = LINK_NIL;
+              p[i - 1].tail = q;
+              STATS_ADD (num_appends, 1);
+              placed_at = i;
+              at_beginning = false;
+              at_end = true;
             }
         }
       else
         {                     /* Cons onto the beginning of a pile. */
-          links[q - 1] = piles[i - 1];
-          piles[i - 1] = q;
+          links[q - 1] = p[i - 1].head;
+          p[i - 1].head = q;
+          STATS_ADD (num_conses, 1);
+          placed_at = i;
+          at_beginning = true;
+          at_end = false;
+        }
+
+      size_t count = 0;
+      if (full)
+        {
+          /* Leave q undealt. */
+        }
+      else if (ascending && at_beginning)
+        {
+          /* Cons the run onto the pile. */
+          count = (placed_at == 1) ? q - r :
+            count_fitting (base, size, compar, arg, q - 1, q - r,
+                           p[placed_at - 2].head, true);
+          for (size_t t = q - 1; t != q - 1 - count; t -= 1)
+            links[t - 1] = t + 1;
+          if (count != 0)
+            p[placed_at - 1].head = q - count;
+          STATS_ADD (num_conses, count);
+        }
+      else if (!ascending && at_end)
+        {
+          /* Append the run to the pile. */
+          count = (placed_at == 1) ? q - r :
+            count_fitting (base, size, compar, arg, q - 1, q - r,
+                           p[placed_at - 2].tail, false);
+          for (size_t t = q; t != q - count; t -= 1)
+            links[t - 1] = t - 1;
+          if (count != 0)
+            {
+              links[q - count - 1] = LINK_NIL;
+              p[placed_at - 1].tail = q - count;
+            }
+          STATS_ADD (num_appends, count);
+        }
+
+      if (!full)
+        {
+          p[placed_at - 1].length += count + 1;
+          q -= count + 1;
         }
     }
 
   *num_piles = m;
+  STATS_ADD (num_piles, m);
+  return (out_of_memory) ? DEAL_FAILED : q;
 }
 
 static inline size_t
@@ -359,180 +936,3178 @@ replay_games (const void *base, size_t size, compar_t *compar,
 }
 
 static void
-merge (const void *base, size_t nmemb, size_t size,
-       compar_t *compar, void *arg,
-       size_t *piles, const size_t *links,
-       size_t total_nodes, size_t *winners,
-       size_t *indices, void *elements)
+stream_copy (void *dst, const void *src, size_t n)
 {
-  for (size_t isorted = 0; isorted != nmemb; isorted += 1)
-    {
-      const size_t winner = winners_get (winners, VALUE, 1);
-      if (indices != NULL)
-        indices[isorted] = winner - 1;
-      if (elements != NULL)
-        memcpy (((char *) elements) + isorted * size,
-                ((char *) base) + (winner - 1) * size,
-                size);
-
-      /* Move to the next element in the winner’s pile. */
-      const size_t ilink = winners_get (winners, LINK, 1);
-      const size_t inext = piles[ilink - 1];
-      if (inext != LINK_NIL)
-        piles[ilink - 1] = links[inext - 1];
-
-      /* Replay games, with the new element as a competitor. */
-      const size_t i = (total_nodes >> 1) + ilink;
-      winners_set (winners, VALUE, i, inext);
-      replay_games (base, size, compar, arg, winners, i);
-    }
+  /* Copy n bytes with non-temporal stores, so that the destination
+     is written without first being read into the cache, and without
+     pushing out what is already there. The caller must fence the
+     stores (see stream_fence) before the data is read back. */
+#if defined __SSE2__
+  char *d = dst;
+  const char *s = src;
+  size_t head = (-(uintptr_t) d) & 15;
+  if (n < head)
+    head = n;
+  memcpy (d, s, head);
+  d += head;
+  s += head;
+  n -= head;
+  for (; 16 <= n; n -= 16, d += 16, s += 16)
+    _mm_stream_si128 ((__m128i *) d,
+                      _mm_loadu_si128 ((const __m128i *) s));
+  memcpy (d, s, n);
+#else
+  memcpy (dst, src, n);
+#endif
 }
 
 static void
-k_way_merge (const void *base, size_t nmemb, size_t size,
-             compar_t *compar, void *arg,
-             size_t num_piles, size_t *piles,
-             const size_t *links, size_t *winners,
-             size_t *indices, void *elements)
+stream_fence (void)
 {
-  /*
-    k-way merge by tournament tree.
+#if defined __SSE2__
+  _mm_sfence ();
+#endif
+}
 
-    See Knuth, volume 3, and also
-    https://en.wikipedia.org/w/index.php?title=K-way_merge_algorithm&oldid=1047851465#Tournament_Tree
+/*
+  A staging buffer for output to the elements array. Winners of a
+  merge are gathered here and written out a buffer at a time by
+  stream_copy. The output of a merge goes in order, so the staged
+  elements are always consecutive in the result.
+*/
+struct stage
+{
+  char buf[STAGE_BYTES];
+  char *elements;               /* The array being written. */
+  size_t size;                  /* The size of an element. */
+  size_t start;                 /* Where the staged elements go. */
+  size_t fill;                  /* How many bytes are staged. */
+};
 
-    However, I store a winners tree instead of the recommended losers
-    tree. If the tree were stored as linked nodes, it would probably
-    be more efficient to store a losers tree. However, I am storing
-    the tree as an array, and one can find an opponent quickly by
-    simply toggling the least significant bit of a competitor's array
-    index.
-  */
+static _Thread_local struct stage *current_stage;
 
-  const size_t total_external_nodes = next_power_of_two (num_piles);
-  const size_t total_nodes = (2 * total_external_nodes) - 1;
-  
-  /* We will ignore index 0 of the winners tree arrays. */
-  const size_t winners_size = total_nodes + 1;
+static void
+stage_flush (struct stage *stage)
+{
+  stream_copy (stage->elements + stage->start * stage->size,
+               stage->buf, stage->fill);
+  stage->start += stage->fill / stage->size;
+  stage->fill = 0;
+}
 
-  memset (winners, LINK_NIL, 2 * winners_size * sizeof (size_t));
-  init_competitors (total_external_nodes, winners, num_piles, piles);
-  discard_top_of_each_pile (num_piles, piles, links);
-  build_tree (base, size, compar, arg, total_external_nodes, winners);
-  merge (base, nmemb, size, compar, arg, piles, links,
-         total_nodes, winners, indices, elements);
+static void
+stage_begin (struct stage *stage, void *elements, size_t size)
+{
+  stage->elements = elements;
+  stage->size = size;
+  stage->start = 0;
+  stage->fill = 0;
+  current_stage = stage;
 }
 
-static void *
-xmalloc (size_t n)
+static void
+stage_end (struct stage *stage)
 {
-  void *p = malloc (n);
-  if (p == NULL)
-    {
-      /* LCOV_EXCL_START */
-      fprintf
-        (stderr,
-         "Memory exhausted while trying to allocate %zu bytes.\n",
-         n);
-      exit (1);
-      /* LCOV_EXCL_STOP */
-    }
-  return p;
+  stage_flush (stage);
+  stream_fence ();
+  current_stage = NULL;
 }
 
 static void
-sort_out_of_place (const void *base, size_t nmemb, size_t size,
-                   compar_t *compar, void *arg,
-                   size_t *indices, void *elements)
+stage_output (struct stage *stage, const char *src, size_t isorted,
+              size_t count)
 {
-  if (nmemb == 0)
+  const size_t bytes = count * stage->size;
+  if (isorted != stage->start + stage->fill / stage->size)
     {
-      /* Do nothing. */
+      /* Not where the staged elements end. Start afresh there. */
+      stage_flush (stage);
+      stage->start = isorted;
     }
-  else if (nmemb <= LEN_THRESHOLD)
+  if (STAGE_BYTES - stage->fill < bytes)
+    stage_flush (stage);
+  if (STAGE_BYTES < bytes)
+    {
+      stream_copy (stage->elements + isorted * stage->size, src, bytes);
+      stage->start = isorted + count;
+    }
+  else
     {
-      /* Use stack storage. */
+      memcpy (stage->buf + stage->fill, src, bytes);
+      stage->fill += bytes;
+    }
+}
 
-      size_t piles[PILES_SIZE];
-      size_t links[LINKS_SIZE];
-      size_t workspace[WORKSPACE_SIZE];
+static struct stage *
+stage_open (void *elements, size_t nmemb, size_t size)
+{
+  /* A stage for output of nmemb elements to the elements array, if
+     the output is large enough to be streamed. Otherwise, or if there
+     is no memory for a stage, return NULL, and the output is simply
+     written. */
+  struct stage *stage = NULL;
+  if (elements != NULL
+      && PATIENCE_SORT_STREAM_MIN_BYTES / size <= nmemb)
+    {
+      stage = allocate (sizeof (struct stage));
+      if (stage != NULL)
+        stage_begin (stage, elements, size);
+    }
+  return stage;
+}
 
-      size_t *const last_elems = workspace;
-      size_t *const tails = workspace + nmemb;
+static void
+stage_close (struct stage *stage)
+{
+  if (stage != NULL)
+    {
+      stage_end (stage);
+      release (stage, sizeof (struct stage));
+    }
+}
 
-      size_t num_piles;
+static inline void
+output_stretch (const void *base, size_t size,
+                size_t *indices, void *elements,
+                size_t isorted, size_t i, size_t count)
+{
+  /* Output the count elements i, i + 1, i + 2, ..., starting at
+     position isorted of the result. */
+  if (indices != NULL)
+    for (size_t j = 0; j != count; j += 1)
+      indices[isorted + j] = (i - 1) + j;
+  if (elements != NULL)
+    {
+      const char *const src = ((const char *) base) + (i - 1) * size;
+      if (current_stage != NULL && current_stage->elements == elements)
+        stage_output (current_stage, src, isorted, count);
+      else
+        memcpy (((char *) elements) + isorted * size, src, count * size);
+    }
+}
 
-      patience_sort_deal (base, nmemb, size, compar, arg,
-                          &num_piles, piles, links,
-                          last_elems, tails);
+static size_t
+gallop (const void *base, size_t size, compar_t *compar, void *arg,
+        size_t *pile, const size_t *links, size_t opponent,
+        size_t isorted, size_t *indices, void *elements)
+{
+  /*
+    Output elements from the top of a pile for as long as they beat
+    the opponent, and leave the pile beginning with the first element
+    that does not. Return the new output position.
 
-      size_t *const winners = workspace;
+    The links array cannot be searched, but wherever a pile holds a
+    stretch of consecutive indices the elements can be got at
+    directly. Such a stretch is searched exponentially, in the manner
+    of timsort's galloping, and then output whole. The links are
+    examined only as far as the search has reached, so the cost stays
+    proportional to what is output.
+  */
 
-      k_way_merge (base, nmemb, size, compar, arg,
-                   num_piles, piles, links, winners,
-                   indices, elements);
+  size_t i = *pile;
+  bool lost = false;
+  while (!lost && i != LINK_NIL)
+    {
+      size_t avail = 1;         /* i .. i + avail - 1 are known. */
+      bool closed = false;      /* Whether the stretch ends there. */
+      size_t won = 0;           /* How many are known to win. */
+      size_t step = 1;
+      bool done = false;
+      while (!done)
+        {
+          size_t target = won + step - 1;
+          while (!closed && avail <= target)
+            {
+              if (links[i + avail - 2] == i + avail)
+                avail += 1;
+              else
+                closed = true;
+            }
+          if (avail <= target)
+            target = avail - 1;
+          if (beats (base, size, compar, arg, i + target, opponent))
+            {
+              won = target + 1;
+              if (won == avail && closed)
+                done = true;
+              else
+                step += step;
+            }
+          else
+            {
+              size_t lo = won;
+              size_t hi = target;
+              while (lo != hi)
+                {
+                  const size_t mid = lo + ((hi - lo) >> 1);
+                  if (beats (base, size, compar, arg, i + mid,
+                             opponent))
+                    lo = mid + 1;
+                  else
+                    hi = mid;
+                }
+              won = lo;
+              lost = true;
+              done = true;
+            }
+        }
+
+      output_stretch (base, size, indices, elements, isorted, i, won);
+      isorted += won;
+      i = (lost) ? i + won : links[i + won - 2];
+    }
+
+  *pile = i;
+  return isorted;
+}
+
+static inline void
+prefetch_pile (const void *base, size_t size, const size_t *links,
+               size_t i)
+{
+  /* Element i of a pile is the one after the pile's competitor in the
+     tree. Prefetch the link and the element that are
+     PATIENCE_SORT_PREFETCH_DISTANCE places along from there, so both
+     are likely in cache by the time they are needed. */
+  for (int d = 1; d < PATIENCE_SORT_PREFETCH_DISTANCE && i != LINK_NIL;
+       d += 1)
+    i = links[i - 1];
+  if (i != LINK_NIL)
+    {
+      PREFETCH (&links[i - 1]);
+      PREFETCH (((const char *) base) + (i - 1) * size);
+    }
+}
+
+static void
+merge (const void *base, size_t nmemb, size_t size,
+       compar_t *compar, void *arg,
+       size_t *piles, const size_t *links,
+       size_t total_nodes, size_t *winners,
+       size_t *indices, void *elements)
+{
+  size_t isorted = 0;
+  size_t previous_ilink = 0;
+  size_t streak = 0;
+
+  while (isorted != nmemb)
+    {
+      const size_t winner = winners_get (winners, VALUE, 1);
+      output_stretch (base, size, indices, elements,
+                      isorted, winner, 1);
+      isorted += 1;
+
+      const size_t ilink = winners_get (winners, LINK, 1);
+      const size_t i = (total_nodes >> 1) + ilink;
+      streak = (ilink == previous_ilink) ? streak + 1 : 1;
+      previous_ilink = ilink;
+
+      if (MIN_GALLOP <= streak && piles[ilink - 1] != LINK_NIL)
+        {
+          /* The same pile keeps winning. Replay the games without
+             it, to find the best of the other piles, and then
+             gallop. */
+          winners_set (winners, VALUE, i, LINK_NIL);
+          replay_games (base, size, compar, arg, winners, i);
+          isorted = gallop (base, size, compar, arg,
+                            &piles[ilink - 1], links,
+                            winners_get (winners, VALUE, 1),
+                            isorted, indices, elements);
+          streak = 0;
+        }
+
+      /* Move to the next element in the winner’s pile. */
+      const size_t inext = piles[ilink - 1];
+      if (inext != LINK_NIL)
+        {
+          piles[ilink - 1] = links[inext - 1];
+          if (PATIENCE_SORT_PREFETCH_DISTANCE != 0)
+            prefetch_pile (base, size, links, piles[ilink - 1]);
+        }
+
+      /* Replay games, with the new element as a competitor. */
+      winners_set (winners, VALUE, i, inext);
+      replay_games (base, size, compar, arg, winners, i);
     }
+}
+
+/*
+  A tournament for keyed sorts. Each node holds, along with the VALUE
+  and LINK of its winner, the winner’s key. Games are decided by the
+  keys whenever they differ, and so the merge looks at the elements
+  themselves only on ties and when outputting them.
+*/
+
+struct keyed_node
+{
+  uint64_t key;
+  size_t value;
+  size_t link;
+};
+
+static inline void
+keyed_node_set (const void *base, size_t size, keyfn_t *key,
+                void *arg, struct keyed_node *node, size_t value)
+{
+  node->value = value;
+  if (value != LINK_NIL)
+    node->key = KEY (((const char *) base) + (value - 1) * size, arg);
+}
+
+static size_t
+play_keyed_game (const void *base, size_t size, compar_t *compar,
+                 void *arg, const struct keyed_node *nodes,
+                 size_t i, size_t j)
+{
+  size_t iwinner;
+
+  if (nodes[i].value == LINK_NIL)
+    iwinner = j;
+  else if (nodes[j].value == LINK_NIL)
+    iwinner = i;
+  else if (nodes[i].key != nodes[j].key)
+    iwinner = (nodes[j].key < nodes[i].key) ? j : i;
   else
+    iwinner = (beats (base, size, compar, arg,
+                      nodes[j].value, nodes[i].value)) ? j : i;
+
+  return iwinner;
+}
+
+static void
+build_keyed_tree (const void *base, size_t size, compar_t *compar,
+                  void *arg, size_t total_external_nodes,
+                  struct keyed_node *nodes)
+{
+  for (size_t i = total_external_nodes - 1; i != 0; i -= 1)
+    nodes[i] =
+      nodes[play_keyed_game (base, size, compar, arg, nodes,
+                             i + i, i + i + 1)];
+}
+
+static void
+replay_keyed_games (const void *base, size_t size, compar_t *compar,
+                    void *arg, struct keyed_node *nodes, size_t i)
+{
+  while (i != 1)
     {
-      /* Use malloc storage. */
+      const size_t iwinner =
+        play_keyed_game (base, size, compar, arg, nodes,
+                         i, find_opponent (i));
+      nodes[i >> 1] = nodes[iwinner];
+      i >>= 1;
+    }
+}
 
-      size_t *piles = xmalloc (nmemb * sizeof (size_t));
-      size_t *links = xmalloc (nmemb * sizeof (size_t));
-      size_t *workspace = xmalloc (2 * nmemb * sizeof (size_t));
+static void
+keyed_merge (const void *base, size_t nmemb, size_t size,
+             compar_t *compar, keyfn_t *key, void *arg,
+             size_t *piles, const size_t *links,
+             size_t total_external_nodes, struct keyed_node *nodes,
+             size_t *indices, void *elements)
+{
+  /* The same as "merge", but with the keyed tree. */
 
-      size_t *const last_elems = workspace;
-      size_t *const tails = workspace + nmemb;
+  size_t isorted = 0;
+  size_t previous_ilink = 0;
+  size_t streak = 0;
 
-      size_t num_piles;
+  while (isorted != nmemb)
+    {
+      output_stretch (base, size, indices, elements,
+                      isorted, nodes[1].value, 1);
+      isorted += 1;
 
-      patience_sort_deal (base, nmemb, size, compar, arg,
-                          &num_piles, piles, links,
-                          last_elems, tails);
+      const size_t ilink = nodes[1].link;
+      const size_t i = total_external_nodes - 1 + ilink;
+      streak = (ilink == previous_ilink) ? streak + 1 : 1;
+      previous_ilink = ilink;
 
-      const size_t power = next_power_of_two (num_piles);
+      if (MIN_GALLOP <= streak && piles[ilink - 1] != LINK_NIL)
+        {
+          nodes[i].value = LINK_NIL;
+          replay_keyed_games (base, size, compar, arg, nodes, i);
+          isorted = gallop (base, size, compar, arg,
+                            &piles[ilink - 1], links, nodes[1].value,
+                            isorted, indices, elements);
+          streak = 0;
+        }
 
-      if (4 * power <= 2 * nmemb)
+      const size_t inext = piles[ilink - 1];
+      if (inext != LINK_NIL)
         {
-          size_t *const winners = workspace;
-          k_way_merge (base, nmemb, size, compar, arg,
-                       num_piles, piles, links, winners,
-                       indices, elements);
-          free (workspace);
+          piles[ilink - 1] = links[inext - 1];
+          if (PATIENCE_SORT_PREFETCH_DISTANCE != 0)
+            prefetch_pile (base, size, links, piles[ilink - 1]);
+        }
+
+      keyed_node_set (base, size, key, arg, &nodes[i], inext);
+      replay_keyed_games (base, size, compar, arg, nodes, i);
+    }
+}
+
+static void
+keyed_k_way_merge (const void *base, size_t nmemb, size_t size,
+                   compar_t *compar, keyfn_t *key, void *arg,
+                   size_t num_piles, size_t *piles,
+                   const size_t *links, struct keyed_node *nodes,
+                   size_t *indices, void *elements)
+{
+  const size_t total_external_nodes = next_power_of_two (num_piles);
+
+  STATS_SET (tournament_size, total_external_nodes);
+
+  STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_BUILD_TREE, merge_comparisons);
+  for (size_t i = 0; i != total_external_nodes; i += 1)
+    {
+      struct keyed_node *node = &nodes[total_external_nodes + i];
+      node->link = i + 1;
+      keyed_node_set (base, size, key, arg, node,
+                      (i < num_piles) ? piles[i] : LINK_NIL);
+    }
+  discard_top_of_each_pile (num_piles, piles, links);
+  build_keyed_tree (base, size, compar, arg,
+                    total_external_nodes, nodes);
+  STATS_PHASE_END (PATIENCE_SORT_PHASE_BUILD_TREE, build_tree_nsec);
+
+  STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_MERGE, merge_comparisons);
+  keyed_merge (base, nmemb, size, compar, key, arg, piles, links,
+               total_external_nodes, nodes, indices, elements);
+  STATS_PHASE_END (PATIENCE_SORT_PHASE_MERGE, merge_nsec);
+}
+
+/*
+  A losers tree laid out in blocks, for large numbers of piles.
+
+  Each block holds the three games of a two-level piece of the binary
+  tree, and has room for four nodes, which on a 64-bit machine fill
+  one cache line. The blocks themselves make a 4-ary tree, stored
+  breadth first. A replay climbs from a leaf to the root and visits
+  one node on each level, so it touches one cache line for every two
+  levels; the winners tree above touches one for every level.
+
+  In a losers tree the node on the path is all a game needs, but a
+  replay is correct only for the leaf of the current champion. That
+  is always the leaf the merge replays. The runner-up, needed for
+  galloping, is the best of the losers on the champion’s path.
+*/
+
+struct blocked_node
+{
+  size_t value;
+  size_t link;
+};
+
+#define BLOCK_NODES 4
+
+static inline size_t
+floor_log2 (size_t i)
+{
+  size_t d = 0;
+  while ((i >> d) != 1)
+    d += 1;
+  return d;
+}
+
+static inline size_t
+blocked_slot (size_t i)
+{
+  /* Where node i of the binary tree (with the root at 1) is kept. */
+#if defined __GNUC__
+  const size_t d = ((sizeof (unsigned long long) * 8) - 1
+                    - (size_t) __builtin_clzll (i));
+#else
+  const size_t d = floor_log2 (i);
+#endif
+  const size_t top = d & ~((size_t) 1); /* The depth of the block. */
+  const size_t first = ((size_t) 1) << top;
+  const size_t block = ((first - 1) / 3) + ((i >> (d - top)) - first);
+  return (BLOCK_NODES * block) + ((d == top) ? 0 : 1 + (i & 1));
+}
+
+static inline size_t
+blocked_parent_slot (size_t slot, size_t i)
+{
+  /* Where node i >> 1 is kept, given that node i is kept at slot. A
+     node in the lower level of a block has its parent at the top of
+     the same block. A node at the top has its parent in the lower
+     level of the parent block, and block b has blocks 4b + 1 through
+     4b + 4 for children. */
+  const size_t block = slot / BLOCK_NODES;
+  return ((slot % BLOCK_NODES) != 0) ? BLOCK_NODES * block :
+    (BLOCK_NODES * ((block - 1) / 4)) + 1 + ((i >> 1) & 1);
+}
+
+static size_t
+blocked_tree_bytes (size_t total_external_nodes)
+{
+  /* There are fewer blocks than external nodes. Allow for aligning
+     the first block. */
+  return ((total_external_nodes + 1)
+          * BLOCK_NODES * sizeof (struct blocked_node));
+}
+
+static struct blocked_node
+build_blocked_subtree (const void *base, size_t size, compar_t *compar,
+                       void *arg, size_t num_piles, const size_t *piles,
+                       size_t total_external_nodes,
+                       struct blocked_node *nodes, size_t i)
+{
+  /* Store the losers of the subtree at i, and return its winner. */
+  struct blocked_node winner;
+  if (total_external_nodes <= i)
+    {
+      const size_t ipile = i - total_external_nodes;
+      winner.value = (ipile < num_piles) ? piles[ipile] : LINK_NIL;
+      winner.link = ipile + 1;
+    }
+  else
+    {
+      struct blocked_node a =
+        build_blocked_subtree (base, size, compar, arg, num_piles,
+                               piles, total_external_nodes, nodes,
+                               i + i);
+      struct blocked_node b =
+        build_blocked_subtree (base, size, compar, arg, num_piles,
+                               piles, total_external_nodes, nodes,
+                               i + i + 1);
+      if (a.value != LINK_NIL
+          && beats (base, size, compar, arg, a.value, b.value))
+        {
+          winner = a;
+          nodes[blocked_slot (i)] = b;
         }
       else
         {
-          free (workspace);
-          size_t *winners = xmalloc (4 * power * sizeof (size_t));
-          k_way_merge (base, nmemb, size, compar, arg,
-                       num_piles, piles, links, winners,
-                       indices, elements);
-          free (winners);
+          winner = b;
+          nodes[blocked_slot (i)] = a;
         }
+    }
+  return winner;
+}
+
+static void
+replay_blocked_games (const void *base, size_t size, compar_t *compar,
+                      void *arg, struct blocked_node *nodes, size_t i,
+                      struct blocked_node *champion)
+{
+  /* Climb from leaf i, with *champion as the competitor there. */
+  struct blocked_node competitor = *champion;
+  i >>= 1;
+  for (size_t slot = blocked_slot (i); i != 0;
+       slot = (i == 1) ? 0 : blocked_parent_slot (slot, i), i >>= 1)
+    {
+      struct blocked_node *node = &nodes[slot];
+      const struct blocked_node other = *node;
+      const bool lost = (other.value != LINK_NIL
+                         && beats (base, size, compar, arg, other.value,
+                                   competitor.value));
+      *node = (lost) ? competitor : other;
+      competitor = (lost) ? other : competitor;
+    }
+  *champion = competitor;
+}
 
-      free (piles);
-      free (links);
+static size_t
+blocked_runner_up (const void *base, size_t size, compar_t *compar,
+                   void *arg, const struct blocked_node *nodes, size_t i)
+{
+  size_t runner_up = LINK_NIL;
+  i >>= 1;
+  for (size_t slot = blocked_slot (i); i != 0;
+       slot = (i == 1) ? 0 : blocked_parent_slot (slot, i), i >>= 1)
+    {
+      const size_t value = nodes[slot].value;
+      if (value != LINK_NIL
+          && beats (base, size, compar, arg, value, runner_up))
+        runner_up = value;
     }
+  return runner_up;
 }
 
 static void
-sort_in_place (void *base, size_t nmemb, size_t size,
-               compar_t *compar, void *arg)
+blocked_merge (const void *base, size_t nmemb, size_t size,
+               compar_t *compar, void *arg,
+               size_t *piles, const size_t *links,
+               size_t total_external_nodes, struct blocked_node *nodes,
+               struct blocked_node champion,
+               size_t *indices, void *elements)
 {
-  /* Sort out of place, then move the result to the original array. */
+  /* The same as "merge", but with the blocked losers tree. */
 
-  if (nmemb * size <= LEN_THRESHOLD * sizeof (size_t))
+  size_t isorted = 0;
+  size_t previous_ilink = 0;
+  size_t streak = 0;
+
+  while (isorted != nmemb)
     {
-      char buffer[nmemb * size];
-      sort_out_of_place (base, nmemb, size, compar, arg,
-                         NULL, buffer);
-      memcpy (base, buffer, nmemb * size);
+      output_stretch (base, size, indices, elements,
+                      isorted, champion.value, 1);
+      isorted += 1;
+
+      const size_t ilink = champion.link;
+      const size_t i = total_external_nodes - 1 + ilink;
+      streak = (ilink == previous_ilink) ? streak + 1 : 1;
+      previous_ilink = ilink;
+
+      if (MIN_GALLOP <= streak && piles[ilink - 1] != LINK_NIL)
+        {
+          isorted = gallop (base, size, compar, arg,
+                            &piles[ilink - 1], links,
+                            blocked_runner_up (base, size, compar, arg,
+                                               nodes, i),
+                            isorted, indices, elements);
+          streak = 0;
+        }
+
+      champion.value = piles[ilink - 1];
+      if (champion.value != LINK_NIL)
+        {
+          piles[ilink - 1] = links[champion.value - 1];
+          if (PATIENCE_SORT_PREFETCH_DISTANCE != 0)
+            prefetch_pile (base, size, links, piles[ilink - 1]);
+        }
+
+      replay_blocked_games (base, size, compar, arg, nodes, i,
+                            &champion);
+    }
+}
+
+static void
+blocked_k_way_merge (const void *base, size_t nmemb, size_t size,
+                     compar_t *compar, void *arg,
+                     size_t num_piles, size_t *piles,
+                     const size_t *links, void *workspace,
+                     size_t *indices, void *elements)
+{
+  const size_t total_external_nodes = next_power_of_two (num_piles);
+
+  /* Start the blocks on a block boundary. */
+  const size_t block_bytes = BLOCK_NODES * sizeof (struct blocked_node);
+  const uintptr_t address = (uintptr_t) workspace;
+  struct blocked_node *nodes =
+    (struct blocked_node *)
+    (((char *) workspace)
+     + ((block_bytes - (address % block_bytes)) % block_bytes));
+
+  STATS_SET (tournament_size, total_external_nodes);
+
+  STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_BUILD_TREE, merge_comparisons);
+  struct blocked_node champion =
+    build_blocked_subtree (base, size, compar, arg, num_piles, piles,
+                           total_external_nodes, nodes, 1);
+  discard_top_of_each_pile (num_piles, piles, links);
+  STATS_PHASE_END (PATIENCE_SORT_PHASE_BUILD_TREE, build_tree_nsec);
+
+  STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_MERGE, merge_comparisons);
+  blocked_merge (base, nmemb, size, compar, arg, piles, links,
+                 total_external_nodes, nodes, champion,
+                 indices, elements);
+  STATS_PHASE_END (PATIENCE_SORT_PHASE_MERGE, merge_nsec);
+}
+
+static void
+merge_one_pile (const void *base, size_t size,
+                compar_t *compar, void *arg,
+                size_t pile, const size_t *links,
+                size_t *indices, void *elements)
+{
+  /* With no opponent, galloping simply walks the pile, copying
+     stretches of consecutive indices whole. */
+  (void) gallop (base, size, compar, arg, &pile, links, LINK_NIL,
+                 0, indices, elements);
+}
+
+static void
+merge_two_piles (const void *base, size_t size,
+                 compar_t *compar, void *arg,
+                 const size_t *piles, const size_t *links,
+                 size_t *indices, void *elements)
+{
+  /* An ordinary two-way merge. The choice of winner is written so it
+     can be compiled without branches. */
+
+  size_t a = piles[0];
+  size_t b = piles[1];
+  size_t isorted = 0;
+  size_t streak = 0;
+  bool previous = false;
+
+  while (a != LINK_NIL && b != LINK_NIL)
+    {
+      const bool take_b = beats (base, size, compar, arg, b, a);
+      const size_t winner = (take_b) ? b : a;
+      output_stretch (base, size, indices, elements,
+                      isorted, winner, 1);
+      isorted += 1;
+
+      const size_t next = links[winner - 1];
+      a = (take_b) ? a : next;
+      b = (take_b) ? next : b;
+
+      streak = (take_b == previous) ? streak + 1 : 1;
+      previous = take_b;
+      if (MIN_GALLOP <= streak)
+        {
+          if (take_b)
+            isorted = gallop (base, size, compar, arg, &b, links, a,
+                              isorted, indices, elements);
+          else
+            isorted = gallop (base, size, compar, arg, &a, links, b,
+                              isorted, indices, elements);
+          streak = 0;
+        }
     }
+
+  /* Output what remains of the other pile. */
+  if (a != LINK_NIL)
+    (void) gallop (base, size, compar, arg, &a, links, LINK_NIL,
+                   isorted, indices, elements);
   else
+    (void) gallop (base, size, compar, arg, &b, links, LINK_NIL,
+                   isorted, indices, elements);
+}
+
+static size_t
+sift_top (const void *base, size_t size, compar_t *compar, void *arg,
+          size_t *tops, size_t n, size_t x)
+{
+  /* tops[1], ..., tops[n - 1] are in order. Put x in its place among
+     them, moving those that beat it down by one. Return where x
+     went. */
+  size_t j = 0;
+  while (j + 1 != n && beats (base, size, compar, arg, tops[j + 1], x))
+    {
+      tops[j] = tops[j + 1];
+      j += 1;
+    }
+  tops[j] = x;
+  return j;
+}
+
+static void
+merge_few_piles (const void *base, size_t size,
+                 compar_t *compar, void *arg,
+                 size_t num_piles, const size_t *piles,
+                 const size_t *links,
+                 size_t *indices, void *elements)
+{
+  /*
+    For a handful of piles, a tournament tree is more machinery than
+    is needed. Keep the tops of the piles in a small array, in order,
+    and put each new top back in its place by scanning from the
+    front. When one pile keeps winning, that costs a single
+    comparison, and the runner-up for galloping is simply the second
+    element of the array.
+  */
+
+  size_t tops[SMALL_K_MAX];
+  size_t n = 0;
+  for (size_t p = 0; p != num_piles; p += 1)
+    {
+      const size_t x = piles[p];
+      size_t j = n;
+      while (j != 0 && beats (base, size, compar, arg, x, tops[j - 1]))
+        {
+          tops[j] = tops[j - 1];
+          j -= 1;
+        }
+      tops[j] = x;
+      n += 1;
+    }
+
+  size_t isorted = 0;
+  size_t streak = 0;
+  while (n != 1)
     {
-      void *buffer = xmalloc (nmemb * size);
-      sort_out_of_place (base, nmemb, size, compar, arg,
-                         NULL, buffer);
-      memcpy (base, buffer, nmemb * size);
-      free (buffer);
+      const size_t winner = tops[0];
+      output_stretch (base, size, indices, elements,
+                      isorted, winner, 1);
+      isorted += 1;
+
+      size_t next = links[winner - 1];
+      if (next == LINK_NIL)
+        {
+          n -= 1;
+          memmove (tops, tops + 1, n * sizeof (size_t));
+          streak = 0;
+        }
+      else if (sift_top (base, size, compar, arg, tops, n, next) != 0)
+        streak = 0;
+      else
+        {
+          streak += 1;
+          if (MIN_GALLOP <= streak)
+            {
+              isorted = gallop (base, size, compar, arg, &next, links,
+                                tops[1], isorted, indices, elements);
+              if (next == LINK_NIL)
+                {
+                  n -= 1;
+                  memmove (tops, tops + 1, n * sizeof (size_t));
+                }
+              else
+                (void) sift_top (base, size, compar, arg,
+                                 tops, n, next);
+              streak = 0;
+            }
+        }
     }
+
+  /* Output what remains of the last pile. */
+  (void) gallop (base, size, compar, arg, &tops[0], links, LINK_NIL,
+                 isorted, indices, elements);
 }
+
+static size_t
+last_winner (const void *base, size_t size, compar_t *compar, void *arg,
+             const size_t *links, size_t i, size_t opponent)
+{
+  /*
+    Given that element i beats the opponent, follow its pile for as
+    long as the elements beat the opponent, and return the last one
+    that does. Stretches of consecutive indices are searched
+    exponentially, as in "gallop".
+  */
+
+  size_t last = i;
+  bool lost = false;
+  while (!lost)
+    {
+      const size_t next = links[last - 1];
+      if (next == LINK_NIL
+          || !beats (base, size, compar, arg, next, opponent))
+        lost = true;
+      else if (next != last + 1)
+        last = next;
+      else
+        {
+          size_t won = 1;       /* next .. next + won - 1 win. */
+          size_t avail = 1;     /* next .. next + avail - 1 are
+                                   known to be consecutive. */
+          bool closed = false;  /* Whether the stretch ends there. */
+          size_t step = 1;
+          bool done = false;
+          while (!done)
+            {
+              size_t target = won + step - 1;
+              while (!closed && avail <= target)
+                {
+                  if (links[next + avail - 2] == next + avail)
+                    avail += 1;
+                  else
+                    closed = true;
+                }
+              if (avail <= target)
+                target = avail - 1;
+              if (target < won)
+                done = true;    /* The whole stretch wins. */
+              else if (beats (base, size, compar, arg, next + target,
+                              opponent))
+                {
+                  won = target + 1;
+                  step += step;
+                }
+              else
+                {
+                  size_t lo = won;
+                  size_t hi = target;
+                  while (lo != hi)
+                    {
+                      const size_t mid = lo + ((hi - lo) >> 1);
+                      if (beats (base, size, compar, arg, next + mid,
+                                 opponent))
+                        lo = mid + 1;
+                      else
+                        hi = mid;
+                    }
+                  won = lo;
+                  lost = true;
+                  done = true;
+                }
+            }
+          last = next + won - 1;
+        }
+    }
+  return last;
+}
+
+static size_t
+link_two_piles (const void *base, size_t size, compar_t *compar,
+                void *arg, size_t *links, size_t a, size_t b)
+{
+  /* Merge two piles into one by relinking their elements, and return
+     the head of the result. Nothing is copied. When one pile keeps
+     winning, whole stretches of it are linked at once. */
+  size_t head = LINK_NIL;
+  size_t *tail = &head;
+  size_t streak = 0;
+  bool previous = false;
+  while (a != LINK_NIL && b != LINK_NIL)
+    {
+      const bool take_b = beats (base, size, compar, arg, b, a);
+      streak = (take_b == previous) ? streak + 1 : 1;
+      previous = take_b;
+
+      size_t *const from = (take_b) ? &b : &a;
+      size_t last = *from;
+      if (MIN_GALLOP <= streak)
+        {
+          last = last_winner (base, size, compar, arg, links, *from,
+                              (take_b) ? a : b);
+          streak = 0;
+        }
+      *tail = *from;
+      tail = &links[last - 1];
+      *from = *tail;
+    }
+  *tail = (a != LINK_NIL) ? a : b;
+  return head;
+}
+
+static void
+sift_shortest (size_t *heap, const struct pile *piles, size_t n,
+               size_t i)
+{
+  /* Restore the order of a min-heap of piles, by length, from i
+     down. */
+  bool done = false;
+  while (!done)
+    {
+      const size_t l = i + i + 1;
+      const size_t r = l + 1;
+      size_t least = i;
+      if (l < n && piles[heap[l]].length < piles[heap[least]].length)
+        least = l;
+      if (r < n && piles[heap[r]].length < piles[heap[least]].length)
+        least = r;
+      if (least == i)
+        done = true;
+      else
+        {
+          const size_t t = heap[i];
+          heap[i] = heap[least];
+          heap[least] = t;
+          i = least;
+        }
+    }
+}
+
+static void
+huffman_merge (const void *base, size_t size,
+               compar_t *compar, void *arg,
+               size_t num_piles, struct pile *piles, size_t *links,
+               size_t *heap, size_t *indices, void *elements)
+{
+  /*
+    Merge the piles two at a time, always the two shortest, as in
+    building a Huffman code. An element then takes part in about as
+    many two-way merges as the bits of a Huffman code for its pile, so
+    elements of long piles take fewer comparisons than they would in
+    a tournament over all the piles. The merges relink the piles in
+    place, and the final pile is output by walking it.
+  */
+
+  size_t n = num_piles;
+  for (size_t i = 0; i != n; i += 1)
+    heap[i] = i;
+  for (size_t i = n / 2; i != 0; i -= 1)
+    sift_shortest (heap, piles, n, i - 1);
+
+  while (1 < n)
+    {
+      const size_t a = heap[0];
+      heap[0] = heap[n - 1];
+      n -= 1;
+      sift_shortest (heap, piles, n, 0);
+      const size_t b = heap[0];
+
+      piles[b].head = link_two_piles (base, size, compar, arg, links,
+                                      piles[a].head, piles[b].head);
+      piles[b].length += piles[a].length;
+      sift_shortest (heap, piles, n, 0);
+    }
+
+  merge_one_pile (base, size, compar, arg, piles[heap[0]].head, links,
+                  indices, elements);
+}
+
+static void
+k_way_merge (const void *base, size_t nmemb, size_t size,
+             compar_t *compar, keyfn_t *key, void *arg,
+             size_t num_piles, size_t *piles,
+             const size_t *links, size_t *winners,
+             size_t *indices, void *elements)
+{
+  /*
+    k-way merge by tournament tree.
+
+    See Knuth, volume 3, and also
+    https://en.wikipedia.org/w/index.php?title=K-way_merge_algorithm&oldid=1047851465#Tournament_Tree
+
+    However, I store a winners tree instead of the recommended losers
+    tree. If the tree were stored as linked nodes, it would probably
+    be more efficient to store a losers tree. However, I am storing
+    the tree as an array, and one can find an opponent quickly by
+    simply toggling the least significant bit of a competitor's array
+    index.
+
+    Nearly sorted data makes very few piles, and those get merges of
+    their own, without a tree. Keyed sorts use a tree that holds the
+    keys, and very many piles get a losers tree laid out in cache-line
+    blocks.
+  */
+
+  if (num_piles <= SMALL_K_MAX)
+    {
+      STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_MERGE, merge_comparisons);
+      if (num_piles == 1)
+        merge_one_pile (base, size, compar, arg, piles[0], links,
+                        indices, elements);
+      else if (num_piles == 2)
+        merge_two_piles (base, size, compar, arg, piles, links,
+                         indices, elements);
+      else
+        merge_few_piles (base, size, compar, arg, num_piles, piles,
+                         links, indices, elements);
+      STATS_PHASE_END (PATIENCE_SORT_PHASE_MERGE, merge_nsec);
+    }
+  else if (key != NULL)
+    keyed_k_way_merge (base, nmemb, size, compar, key, arg,
+                       num_piles, piles, links,
+                       (struct keyed_node *) winners,
+                       indices, elements);
+  else if (PATIENCE_SORT_BLOCKED_TREE_MIN_PILES <= num_piles)
+    blocked_k_way_merge (base, nmemb, size, compar, arg,
+                         num_piles, piles, links, winners,
+                         indices, elements);
+  else
+    {
+      const size_t total_external_nodes =
+        next_power_of_two (num_piles);
+      const size_t total_nodes = (2 * total_external_nodes) - 1;
+  
+      /* We will ignore index 0 of the winners tree arrays. */
+      const size_t winners_size = total_nodes + 1;
+
+      STATS_SET (tournament_size, total_external_nodes);
+
+      STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_BUILD_TREE,
+                         merge_comparisons);
+      memset (winners, LINK_NIL, 2 * winners_size * sizeof (size_t));
+      init_competitors (total_external_nodes, winners,
+                        num_piles, piles);
+      discard_top_of_each_pile (num_piles, piles, links);
+      build_tree (base, size, compar, arg,
+                  total_external_nodes, winners);
+      STATS_PHASE_END (PATIENCE_SORT_PHASE_BUILD_TREE,
+                       build_tree_nsec);
+
+      STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_MERGE, merge_comparisons);
+      merge (base, nmemb, size, compar, arg, piles, links,
+             total_nodes, winners, indices, elements);
+      STATS_PHASE_END (PATIENCE_SORT_PHASE_MERGE, merge_nsec);
+    }
+}
+
+static inline const char *
+record_element (const void *base, size_t size, bool copies,
+                size_t index_offset, const char *record)
+{
+  /* The element of a record: the record itself, if it begins with a
+     copy of the element, or else the element that its index gives. */
+  if (copies)
+    return record;
+  size_t i;
+  memcpy (&i, record + index_offset, sizeof (size_t));
+  return ((const char *) base) + i * size;
+}
+
+static inline bool
+record_precedes (const void *base, size_t size, bool copies,
+                 size_t key_offset, size_t index_offset,
+                 const char *x, uint64_t xkey, const char *y,
+                 compar_t *compar, keyfn_t *key, void *arg)
+{
+  /* Whether the element x sorts before the record y: by the keys, if
+     there are keys and they differ, and otherwise by compar. */
+  if (key != NULL)
+    {
+      uint64_t ykey;
+      memcpy (&ykey, y + key_offset, sizeof (uint64_t));
+      if (xkey != ykey)
+        return (xkey < ykey);
+    }
+  return (COMPAR (x, record_element (base, size, copies, index_offset,
+                                     y), arg) < 0);
+}
+
+static inline void
+put_records (struct stage *stage, char *to, size_t rsize,
+             const char *src, size_t k, size_t count)
+{
+  /* Put count records at place k of to, through the stage if there
+     is one. */
+  if (stage != NULL)
+    stage_output (stage, src, k, count);
+  else
+    memcpy (to + k * rsize, src, count * rsize);
+}
+
+static void
+merge_records (const void *base, size_t size, compar_t *compar,
+               void *arg, size_t rsize, bool copies,
+               size_t index_offset, const char *from, char *to,
+               struct stage *stage, size_t lo, size_t mid, size_t hi)
+{
+  /* Merge the records from lo to mid and from mid to hi, in from,
+     into the same places in to. If there is a stage, the records are
+     the elements themselves, and to is the array it writes. */
+  size_t i = lo;
+  size_t j = mid;
+  size_t k = lo;
+  if (mid != hi
+      && COMPAR (record_element (base, size, copies, index_offset,
+                                 from + mid * rsize),
+                 record_element (base, size, copies, index_offset,
+                                 from + (mid - 1) * rsize), arg) < 0)
+    {
+      while (i != mid && j != hi)
+        {
+          const bool right =
+            (COMPAR (record_element (base, size, copies, index_offset,
+                                     from + j * rsize),
+                     record_element (base, size, copies, index_offset,
+                                     from + i * rsize), arg) < 0);
+          put_records (stage, to, rsize,
+                       from + ((right) ? j : i) * rsize, k, 1);
+          j += right;
+          i += !right;
+          k += 1;
+        }
+    }
+  /* What is left, or the whole of two pieces already in order, is
+     copied as is. */
+  put_records (stage, to, rsize, from + i * rsize, k, mid - i);
+  k += mid - i;
+  put_records (stage, to, rsize, from + j * rsize, k, hi - j);
+}
+
+static void
+merge_keyed_records (const void *base, size_t size, compar_t *compar,
+                     void *arg, size_t rsize, bool copies,
+                     size_t key_offset, size_t index_offset,
+                     const char *from, char *to,
+                     size_t lo, size_t mid, size_t hi)
+{
+  /*
+    The same as merge_records, but for records with keys, which
+    decide wherever they differ. Which key is less is as good as
+    random, so the choice is made without a branch. Keyed records
+    come in whole words, and are copied a word at a time, which beats
+    a call to memcpy for a record this small.
+  */
+  size_t i = lo;
+  size_t j = mid;
+  size_t k = lo;
+  uint64_t ikey;
+  uint64_t jkey;
+  if (mid != hi)
+    {
+      memcpy (&ikey, from + (mid - 1) * rsize + key_offset,
+              sizeof (uint64_t));
+      memcpy (&jkey, from + mid * rsize + key_offset,
+              sizeof (uint64_t));
+    }
+  if (mid != hi
+      && (jkey < ikey
+          || (jkey == ikey
+              && COMPAR (record_element (base, size, copies,
+                                         index_offset,
+                                         from + mid * rsize),
+                         record_element (base, size, copies,
+                                         index_offset,
+                                         from + (mid - 1) * rsize),
+                         arg) < 0)))
+    {
+      while (i != mid && j != hi)
+        {
+          memcpy (&ikey, from + i * rsize + key_offset,
+                  sizeof (uint64_t));
+          memcpy (&jkey, from + j * rsize + key_offset,
+                  sizeof (uint64_t));
+          bool right = (jkey < ikey);
+          if (jkey == ikey)
+            right =
+              (COMPAR (record_element (base, size, copies, index_offset,
+                                       from + j * rsize),
+                       record_element (base, size, copies, index_offset,
+                                       from + i * rsize), arg) < 0);
+          const char *const src = from + ((right) ? j : i) * rsize;
+          for (size_t w = 0; w != rsize; w += sizeof (uint64_t))
+            {
+              uint64_t word;
+              memcpy (&word, src + w, sizeof (uint64_t));
+              memcpy (to + k * rsize + w, &word, sizeof (uint64_t));
+            }
+          j += right;
+          i += !right;
+          k += 1;
+        }
+    }
+  memcpy (to + k * rsize, from + i * rsize, (mid - i) * rsize);
+  k += mid - i;
+  memcpy (to + k * rsize, from + j * rsize, (hi - j) * rsize);
+}
+
+static void
+sort_records (const void *base, size_t nmemb, size_t size,
+              compar_t *compar, keyfn_t *key, void *arg, size_t rsize,
+              bool copies, size_t key_offset, size_t index_offset,
+              char *first, char *second, struct stage *stage,
+              size_t *indices, void *elements)
+{
+  /* The body of merge_sort: sort records of rsize bytes, each
+     beginning with a copy of its element if copies is set, with the
+     key (if any) at key_offset and the index (if any) at
+     index_offset, starting in first and going back and forth between
+     first and second. If there is a stage, the elements are written
+     through it: by the last pass, if that writes the elements array,
+     or else by the copy out of the records. */
+
+  const bool with_index = (indices != NULL || !copies);
+
+  /* Insertion sort runs of MERGE_SORT_RUN into the first buffer. */
+  for (size_t lo = 0; lo < nmemb; lo += MERGE_SORT_RUN)
+    {
+      const size_t hi =
+        (nmemb - lo < MERGE_SORT_RUN) ? nmemb : lo + MERGE_SORT_RUN;
+      for (size_t i = lo; i != hi; i += 1)
+        {
+          const char *const x = ((const char *) base) + i * size;
+          const uint64_t xkey = (key != NULL) ? KEY (x, arg) : 0;
+          size_t j = i;
+          while (j != lo
+                 && record_precedes (base, size, copies, key_offset,
+                                     index_offset, x, xkey,
+                                     first + (j - 1) * rsize,
+                                     compar, key, arg))
+            j -= 1;
+          memmove (first + (j + 1) * rsize, first + j * rsize,
+                   (i - j) * rsize);
+          if (copies)
+            memcpy (first + j * rsize, x, size);
+          if (key != NULL)
+            memcpy (first + j * rsize + key_offset, &xkey,
+                    sizeof (uint64_t));
+          if (with_index)
+            memcpy (first + j * rsize + index_offset, &i,
+                    sizeof (size_t));
+        }
+    }
+
+  char *from = first;
+  char *to = second;
+  for (size_t width = MERGE_SORT_RUN; width < nmemb; width += width)
+    {
+      for (size_t lo = 0; lo < nmemb; lo += width + width)
+        {
+          const size_t mid = (nmemb - lo < width) ? nmemb : lo + width;
+          const size_t hi =
+            (nmemb - mid < width) ? nmemb : mid + width;
+          if (key != NULL)
+            merge_keyed_records (base, size, compar, arg, rsize, copies,
+                                 key_offset, index_offset, from, to,
+                                 lo, mid, hi);
+          else
+            merge_records (base, size, compar, arg, rsize, copies,
+                           index_offset, from, to,
+                           (nmemb <= width + width && to == elements) ?
+                           stage : NULL,
+                           lo, mid, hi);
+        }
+      char *const t = from;
+      from = to;
+      to = t;
+    }
+
+  if (!(copies && rsize == size))
+    {
+      if (indices != NULL)
+        for (size_t k = 0; k != nmemb; k += 1)
+          memcpy (&indices[k], from + k * rsize + index_offset,
+                  sizeof (size_t));
+      if (elements != NULL)
+        for (size_t k = 0; k != nmemb; k += 1)
+          put_records (stage, elements, size,
+                       record_element (base, size, copies, index_offset,
+                                       from + k * rsize),
+                       k, 1);
+    }
+}
+
+static bool
+merge_sort (const void *base, size_t nmemb, size_t size,
+            compar_t *compar, keyfn_t *key, void *arg,
+            size_t *indices, void *elements)
+{
+  /*
+    A stable, bottom-up merge sort, used instead of dealing when the
+    data proves to be disorderly.
+
+    What gets sorted are records holding copies of the elements, each
+    followed by its key if there is a key, and by its index if indices
+    are wanted, so that every pass reads and writes memory in
+    order. Sorting indices instead, and comparing through them, would
+    miss the caches at nearly every comparison once the array is
+    large. The keys are taken once, and decide every comparison where
+    they differ.
+
+    Elements larger than MERGE_SORT_COPY_MAX are not copied, though:
+    their records hold only the key and the index, and each element
+    is copied once, to the output, at the end. Such elements are sent
+    here only in keyed sorts, where the keys in the records decide
+    nearly every comparison.
+
+    Return false if there is no memory for the records.
+  */
+
+  const bool copies = (size <= MERGE_SORT_COPY_MAX);
+  size_t rsize = (copies) ? size : 0;
+  size_t key_offset = 0;
+  size_t index_offset = 0;
+  if (key != NULL)
+    {
+      key_offset =
+        ((rsize + sizeof (uint64_t) - 1) / sizeof (uint64_t))
+        * sizeof (uint64_t);
+      rsize = key_offset + sizeof (uint64_t);
+    }
+  if (indices != NULL || !copies)
+    {
+      index_offset =
+        ((rsize + sizeof (size_t) - 1) / sizeof (size_t))
+        * sizeof (size_t);
+      rsize = index_offset + sizeof (size_t);
+    }
+
+  /* The last pass writes the result where it belongs, if the records
+     are nothing but the elements. */
+  const bool bare = (copies && rsize == size);
+  if (!bare)
+    {
+      /* Keep the elements in the records as aligned as they are in
+         the array, and the keys aligned. */
+      size_t align = 1;
+      if (copies)
+        align =
+          ((size & -size) < _Alignof (max_align_t)) ?
+          (size & -size) : _Alignof (max_align_t);
+      if (key != NULL && align < sizeof (uint64_t))
+        align = sizeof (uint64_t);
+      rsize = ((rsize + align - 1) / align) * align;
+    }
+
+  size_t passes = 0;
+  for (size_t width = MERGE_SORT_RUN; width < nmemb; width += width)
+    passes += 1;
+
+  char *const scratch = workspace_alloc (nmemb * rsize);
+  char *const other =
+    (bare) ? elements : workspace_alloc (nmemb * rsize);
+  const bool ok = (scratch != NULL && other != NULL);
+  if (ok)
+    {
+      /* A large output is staged and streamed, as by merge_all. */
+      struct stage *const stage = stage_open (elements, nmemb, size);
+      sort_records (base, nmemb, size, compar, key, arg, rsize, copies,
+                    key_offset, index_offset,
+                    (passes % 2 == 0) ? other : scratch,
+                    (passes % 2 == 0) ? scratch : other,
+                    stage, indices, elements);
+      stage_close (stage);
+    }
+  if (!bare)
+    workspace_free (other, nmemb * rsize);
+  workspace_free (scratch, nmemb * rsize);
+  return ok;
+}
+
+static bool
+group_by_value (const void *base, size_t nmemb, size_t size,
+                compar_t *compar, void *arg, size_t max_distinct,
+                size_t *ids, size_t *table, size_t *reps,
+                size_t *counts, size_t *num_distinct)
+{
+  /*
+    Number the different values in the order they first appear, and
+    put the number of each element’s value in ids, for as long as
+    there are no more than max_distinct values. The table lists the
+    numbers in order of value, reps holds the first element with each
+    value, and counts how many elements have it. Return false if
+    there prove to be too many values, or if the first sixteenth of
+    the array is in order: the deal makes a single pile of that, at a
+    comparison per element, and grouping it would gain nothing.
+
+    Each element is compared first with the value before it. That
+    settles a run of equal values at one comparison per element, and
+    otherwise narrows the binary search of the table to the side of
+    the value before. An element above every value so far takes no
+    search at all, so that data in order costs one comparison per
+    element, for however long it is looked at.
+  */
+
+  const size_t in_order_max = nmemb / 16;
+  size_t d = 0;
+  size_t previous = SIZE_MAX;
+  size_t place = 0;             /* Where previous is in the table. */
+  bool in_order = true;
+  bool few = true;
+  for (size_t i = 0; few && i != nmemb; i += 1)
+    {
+      const char *const x = ((const char *) base) + i * size;
+      const int cmp_previous =
+        (previous == SIZE_MAX) ? 1 :
+        COMPAR (x, ((const char *) base) + reps[previous] * size, arg);
+      size_t id = previous;
+      if (cmp_previous != 0)
+        {
+          size_t lo = 0;
+          size_t hi = d;
+          if (previous == SIZE_MAX)
+            {
+              /* The first element. The table is empty. */
+            }
+          else if (cmp_previous < 0)
+            hi = place;
+          else
+            lo = place + 1;
+          bool found = false;
+          while (!found && lo != hi)
+            {
+              const size_t mid = lo + ((hi - lo) >> 1);
+              const int cmp =
+                COMPAR (x, ((const char *) base) + reps[table[mid]] * size,
+                        arg);
+              if (cmp == 0)
+                {
+                  found = true;
+                  lo = mid;
+                }
+              else if (cmp < 0)
+                hi = mid;
+              else
+                lo = mid + 1;
+            }
+          in_order = in_order && (0 < cmp_previous);
+          if (found)
+            id = table[lo];
+          else if (d == max_distinct)
+            few = false;
+          else
+            {
+              memmove (&table[lo + 1], &table[lo],
+                       (d - lo) * sizeof (size_t));
+              id = d;
+              table[lo] = id;
+              reps[id] = i;
+              counts[id] = 0;
+              d += 1;
+            }
+          place = lo;
+        }
+      if (in_order && i == in_order_max)
+        few = false;
+      if (few)
+        {
+          ids[i] = id;
+          counts[id] += 1;
+          previous = id;
+        }
+    }
+
+  *num_distinct = d;
+  return few;
+}
+
+static void
+output_groups (const void *base, size_t nmemb, size_t size,
+               size_t num_distinct, const size_t *ids,
+               const size_t *table, size_t *counts,
+               size_t *indices, void *elements)
+{
+  /* Turn the counts into where each value goes, in order of value,
+     and then send each element there. Elements with equal values
+     stay in order of index. */
+  size_t total = 0;
+  for (size_t p = 0; p != num_distinct; p += 1)
+    {
+      const size_t count = counts[table[p]];
+      counts[table[p]] = total;
+      total += count;
+    }
+  for (size_t i = 0; i != nmemb; i += 1)
+    {
+      output_stretch (base, size, indices, elements,
+                      counts[ids[i]], i + 1, 1);
+      counts[ids[i]] += 1;
+    }
+}
+
+static size_t
+tree_bytes (size_t num_piles, keyfn_t *key)
+{
+  /* The room k_way_merge needs for a tree. */
+  const size_t power = next_power_of_two (num_piles);
+  return
+    (num_piles <= SMALL_K_MAX) ? 0 :
+    (key != NULL) ? 2 * power * sizeof (struct keyed_node) :
+    (PATIENCE_SORT_BLOCKED_TREE_MIN_PILES <= num_piles) ?
+    blocked_tree_bytes (power) :
+    4 * power * sizeof (size_t);
+}
+
+static bool
+piles_are_capped (size_t nmemb, size_t max_piles)
+{
+  /* Is there a cap that the deal could reach? */
+  return (max_piles != 0 && max_piles < nmemb);
+}
+
+static bool
+deal_runs (const void *base, size_t nmemb, size_t size,
+           compar_t *compar, keyfn_t *key, void *arg,
+           size_t max_piles, size_t *links,
+           size_t *num_heads, size_t **heads, size_t *heads_bytes)
+{
+  /*
+    Deal with no more than max_piles piles at a time. Whenever the
+    cap is reached, merge the piles into a run, linked through the
+    links array like a pile, and go on dealing with fresh piles. Then
+    the runs can be merged as if they were piles. The searches of the
+    deal, and the tree of each merge, stay small enough to be kept in
+    the fastest cache, at the price of one more merge at the end.
+
+    If everything fits in the first lot of piles, those piles are
+    left as they are. Either way, put how many piles (or runs) there
+    are to merge in *num_heads, and their heads in *heads, which is
+    from allocate and *heads_bytes long. Return false if memory runs
+    out.
+
+    Each deal but the last reaches the cap, and so deals at least
+    max_piles elements. There are therefore no more than
+    nmemb / max_piles + 1 runs. Their heads are kept after those of
+    the piles.
+  */
+
+  size_t capacity = max_piles;
+  const size_t piles_bytes = capacity * sizeof (struct pile);
+  const size_t pile_heads_and_runs_bytes =
+    (max_piles + nmemb / max_piles + 1) * sizeof (size_t);
+  const size_t winners_bytes =
+    (tree_bytes (max_piles, key) != 0) ? tree_bytes (max_piles, key) : 1;
+  const size_t run_bytes = nmemb * sizeof (size_t);
+
+  struct pile *piles = allocate (piles_bytes);
+  size_t *pile_heads_and_runs = allocate (pile_heads_and_runs_bytes);
+  size_t *const runs = pile_heads_and_runs + max_piles;
+  size_t *const winners = allocate (winners_bytes);
+  size_t *run = NULL;
+
+  bool ok = (piles != NULL && pile_heads_and_runs != NULL
+             && winners != NULL);
+  size_t result = 0;
+  size_t num_runs = 0;
+  size_t top = nmemb;
+  bool done = !ok;
+  while (!done)
+    {
+      size_t num_piles;
+
+      /* The cap is never above the capacity, so the deal cannot run
+         out of memory. */
+      STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_DEAL, deal_comparisons);
+      const size_t undealt =
+        patience_sort_deal (base, top, size, compar, arg, max_piles,
+                            false, &num_piles, &piles, &capacity,
+                            links);
+      STATS_PHASE_END (PATIENCE_SORT_PHASE_DEAL, deal_nsec);
+      pile_heads (num_piles, piles, pile_heads_and_runs);
+
+      if (num_runs == 0 && undealt == 0)
+        {
+          /* The cap was never reached. */
+          result = num_piles;
+          done = true;
+        }
+      else
+        {
+          if (run == NULL)
+            run = workspace_alloc (run_bytes);
+          if (run == NULL)
+            {
+              ok = false;
+              done = true;
+            }
+          else
+            {
+              const size_t len = top - undealt;
+              k_way_merge (base, len, size, compar, key, arg,
+                           num_piles, pile_heads_and_runs, links,
+                           winners, run, NULL);
+              for (size_t j = 0; j != len - 1; j += 1)
+                links[run[j]] = run[j + 1] + 1;
+              links[run[len - 1]] = LINK_NIL;
+              runs[num_runs] = run[0] + 1;
+              num_runs += 1;
+
+              top = undealt;
+              if (top == 0)
+                {
+                  memmove (pile_heads_and_runs, runs,
+                           num_runs * sizeof (size_t));
+                  result = num_runs;
+                  done = true;
+                }
+            }
+        }
+    }
+
+  release (piles, piles_bytes);
+  release (winners, winners_bytes);
+  workspace_free (run, run_bytes);
+  if (!ok)
+    {
+      release (pile_heads_and_runs, pile_heads_and_runs_bytes);
+      pile_heads_and_runs = NULL;
+    }
+  *num_heads = result;
+  *heads = pile_heads_and_runs;
+  *heads_bytes = pile_heads_and_runs_bytes;
+  return ok;
+}
+
+static bool
+merge_all (const void *base, size_t nmemb, size_t size,
+           compar_t *compar, keyfn_t *key, void *arg,
+           size_t num_piles, struct pile *piles, size_t *heads,
+           size_t *links, size_t *indices, void *elements)
+{
+  /*
+    Merge the piles of sort_out_of_place, by the Huffman planner if
+    that is chosen and the descriptors are at hand, and otherwise by
+    k_way_merge, from the heads. Return false if memory runs out.
+  */
+
+  /* A large output is staged and streamed, so that writing it does
+     not push the piles and the tree out of the cache. */
+  struct stage *const stage = stage_open (elements, nmemb, size);
+
+  bool ok;
+  if (heads == NULL)
+    {
+      const size_t heap_bytes = num_piles * sizeof (size_t);
+      size_t *heap = allocate (heap_bytes);
+      ok = (heap != NULL);
+      if (ok)
+        {
+          STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_MERGE,
+                             merge_comparisons);
+          huffman_merge (base, size, compar, arg, num_piles, piles,
+                         links, heap, indices, elements);
+          STATS_PHASE_END (PATIENCE_SORT_PHASE_MERGE, merge_nsec);
+        }
+      release (heap, heap_bytes);
+    }
+  else
+    {
+      const size_t winners_bytes =
+        (tree_bytes (num_piles, key) != 0) ?
+        tree_bytes (num_piles, key) : 1;
+      size_t *winners = allocate (winners_bytes);
+      ok = (winners != NULL);
+      if (ok)
+        k_way_merge (base, nmemb, size, compar, key, arg,
+                     num_piles, heads, links, winners,
+                     indices, elements);
+      release (winners, winners_bytes);
+    }
+
+  stage_close (stage);
+  return ok;
+}
+
+static void
+sort_short (const void *base, size_t nmemb, size_t size,
+            compar_t *compar, void *arg, struct pile *piles,
+            size_t *heads, size_t *links, size_t *winners,
+            size_t *indices, void *elements)
+{
+  /* Deal and merge, with no cap and no giving up, in storage the
+     caller provides. There is a descriptor for every pile there could
+     be, so the deal never has to grow the array. The winners must
+     have room for the tree of nmemb piles. */
+
+  size_t capacity = nmemb;
+  size_t num_piles;
+
+  STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_DEAL, deal_comparisons);
+  patience_sort_deal (base, nmemb, size, compar, arg, SIZE_MAX, false,
+                      &num_piles, &piles, &capacity, links);
+  STATS_PHASE_END (PATIENCE_SORT_PHASE_DEAL, deal_nsec);
+
+  pile_heads (num_piles, piles, heads);
+  k_way_merge (base, nmemb, size, compar, NULL, arg,
+               num_piles, heads, links, winners, indices, elements);
+}
+
+static bool
+try_sort_out_of_place (const void *base, size_t nmemb, size_t size,
+                       compar_t *compar, keyfn_t *key, void *arg,
+                       size_t *indices, void *elements)
+{
+  /* Return false, having output nothing that can be relied on, if
+     memory runs out. */
+
+  bool ok = true;
+  if (nmemb == 0)
+    {
+      /* Do nothing. */
+    }
+  else if (nmemb <= LEN_THRESHOLD)
+    {
+      /* Use stack storage. Keys would not be worth the trouble. */
+
+      struct pile piles[PILES_SIZE];
+      size_t heads[PILES_SIZE];
+      size_t links[LINKS_SIZE];
+      size_t winners[WORKSPACE_SIZE];
+
+      sort_short (base, nmemb, size, compar, arg,
+                  piles, heads, links, winners, indices, elements);
+    }
+  else
+    {
+      /* Use allocated storage. Only the links go by the number of
+         elements. The pile descriptors, the pile heads, and the tree
+         go by the number of piles. */
+
+      const size_t links_bytes = nmemb * sizeof (size_t);
+      size_t *links = workspace_alloc (links_bytes);
+      struct pile *piles = NULL;
+      size_t capacity = 0;
+      size_t *heads = NULL;
+      size_t heads_bytes = 0;
+
+      size_t num_piles = 0;
+      size_t undealt = 0;
+      size_t num_distinct = 0;
+      bool grouped = false;
+      ok = (links != NULL);
+
+      /* Try grouping equal values first. The element numbers of
+         the values go into the links array. */
+      if (ok && FEW_DISTINCT_MIN_NMEMB <= nmemb)
+        {
+          const size_t table_bytes =
+            3 * FEW_DISTINCT_MAX * sizeof (size_t);
+          size_t *const table = allocate (table_bytes);
+          ok = (table != NULL);
+          if (ok)
+            {
+              size_t *const reps = table + FEW_DISTINCT_MAX;
+              size_t *const counts = reps + FEW_DISTINCT_MAX;
+
+              STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_DEAL,
+                                 deal_comparisons);
+              grouped = group_by_value (base, nmemb, size, compar, arg,
+                                        FEW_DISTINCT_MAX, links, table,
+                                        reps, counts, &num_distinct);
+              STATS_PHASE_END (PATIENCE_SORT_PHASE_DEAL, deal_nsec);
+
+              if (grouped)
+                {
+                  STATS_SET (num_distinct, num_distinct);
+                  STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_MERGE,
+                                     merge_comparisons);
+                  output_groups (base, nmemb, size, num_distinct, links,
+                                 table, counts, indices, elements);
+                  STATS_PHASE_END (PATIENCE_SORT_PHASE_MERGE,
+                                   merge_nsec);
+                }
+            }
+          release (table, table_bytes);
+        }
+
+      const size_t max_piles = patience_sort_max_piles;
+      if (!ok || grouped)
+        {
+          /* Failed, or done. */
+        }
+      else if (piles_are_capped (nmemb, max_piles))
+        ok = deal_runs (base, nmemb, size, compar, key, arg, max_piles,
+                        links, &num_piles, &heads, &heads_bytes);
+      else
+        {
+          /* Give up on disorderly data only if the merge sort can
+             go by copies of the elements or by keys. Comparing large
+             elements through their indices, pass after pass, would
+             miss the cache at nearly every step; the deal and the
+             merge touch each element about once. */
+          const bool adaptive =
+            (size <= MERGE_SORT_COPY_MAX || key != NULL);
+          STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_DEAL,
+                             deal_comparisons);
+          undealt = patience_sort_deal (base, nmemb, size, compar, arg,
+                                        SIZE_MAX, adaptive, &num_piles,
+                                        &piles, &capacity, links);
+          STATS_PHASE_END (PATIENCE_SORT_PHASE_DEAL, deal_nsec);
+          ok = (undealt != DEAL_FAILED);
+
+          /* The Huffman planner merges by the descriptors. Anything
+             else wants the heads. */
+          if (ok && undealt == 0
+              && !(patience_sort_merge_planner == PATIENCE_MERGE_HUFFMAN
+                   && SMALL_K_MAX < num_piles))
+            {
+              heads_bytes = num_piles * sizeof (size_t);
+              heads = allocate (heads_bytes);
+              ok = (heads != NULL);
+              if (ok)
+                pile_heads (num_piles, piles, heads);
+            }
+        }
+
+      if (!ok || grouped)
+        {
+          /* Failed, or already output. */
+        }
+      else if (undealt != 0)
+        {
+          /* The deal gave up. Merge sort everything instead. */
+          STATS_ADD (num_undealt, undealt);
+          STATS_PHASE_BEGIN (PATIENCE_SORT_PHASE_MERGE,
+                             merge_comparisons);
+          ok = merge_sort (base, nmemb, size, compar, key, arg,
+                           indices, elements);
+          STATS_PHASE_END (PATIENCE_SORT_PHASE_MERGE, merge_nsec);
+        }
+      else
+        ok = merge_all (base, nmemb, size, compar, key, arg,
+                        num_piles, piles, heads, links,
+                        indices, elements);
+
+      workspace_free (links, links_bytes);
+      release (piles, capacity * sizeof (struct pile));
+      release (heads, heads_bytes);
+    }
+  return ok;
+}
+
+static void
+sort_out_of_place (const void *base, size_t nmemb, size_t size,
+                   compar_t *compar, keyfn_t *key, void *arg,
+                   size_t *indices, void *elements)
+{
+  exit_if_out_of_memory (try_sort_out_of_place (base, nmemb, size,
+                                                compar, key, arg,
+                                                indices, elements));
+}
+
+#if !PATIENCE_SORT_STATS
+
+static bool
+is_sorted (const void *base, size_t nmemb, size_t size,
+           compar_t *compar, void *arg)
+{
+  bool sorted = true;
+  for (size_t i = 1; sorted && i < nmemb; i += 1)
+    sorted = (COMPAR (((const char *) base) + (i - 1) * size,
+                      ((const char *) base) + i * size, arg) <= 0);
+  return sorted;
+}
+
+static void
+estimate_disorder (const void *base, size_t nmemb, size_t size,
+                   compar_t *compar, void *arg, size_t sample_rate,
+                   struct patience_disorder *est)
+{
+  /*
+    Take every sample_rate-th element as the sample. Treating the
+    sample as an array whose elements are sample_rate * size bytes
+    apart lets it be dealt in place, with no copying.
+  */
+
+  const size_t rate =
+    (sample_rate == 0) ? 1 :
+    (sample_rate <= nmemb || nmemb == 0) ? sample_rate : nmemb;
+  const size_t stride = rate * size;
+  const size_t n = (nmemb / rate) + (nmemb % rate != 0);
+
+  size_t num_runs = 0;
+  bool ascending = true;
+  for (size_t q = n; q != 0; num_runs += 1)
+    q = find_run (base, stride, compar, arg, q, &ascending) - 1;
+
+  size_t num_piles = (n == 0) ? 0 : 1;
+  if (1 < num_runs)
+    {
+      size_t *links = allocate (n * sizeof (size_t));
+      struct pile *piles = NULL;
+      size_t capacity = 0;
+      exit_if_out_of_memory (links != NULL);
+      exit_if_out_of_memory (patience_sort_deal (base, n, stride, compar,
+                                                 arg, SIZE_MAX, false,
+                                                 &num_piles, &piles,
+                                                 &capacity, links)
+                             != DEAL_FAILED);
+      release (links, n * sizeof (size_t));
+      release (piles, capacity * sizeof (struct pile));
+    }
+
+  est->sample_size = n;
+  est->num_runs = num_runs;
+  est->num_piles = num_piles;
+  if (num_runs <= 1)
+    est->disorder_class =
+      (n <= 1 || ascending) ?
+      PATIENCE_DISORDER_SORTED : PATIENCE_DISORDER_REVERSED;
+  else if (num_piles <= floor_log2 (n) + 1)
+    est->disorder_class = PATIENCE_DISORDER_NEARLY_SORTED;
+  else if (num_piles * num_piles <= n)
+    est->disorder_class = PATIENCE_DISORDER_PARTLY_SORTED;
+  else
+    est->disorder_class = PATIENCE_DISORDER_RANDOM;
+}
+
+/*
+  Piles dealt by patience_deal, to be merged later. The compar
+  procedure is kept in whichever field suits the translation unit
+  that dealt the piles, and that unit supplies the merge.
+*/
+struct patience_piles
+{
+  const void *base;
+  size_t nmemb;
+  size_t size;
+  int (*compar) (const void *, const void *);
+  int (*compar_r) (const void *, const void *, void *);
+  void *arg;
+  void (*merge) (struct patience_piles *, size_t *, void *);
+  struct allocator allocator;   /* What the piles were allocated by. */
+  bool merged;
+  size_t num_piles;
+  size_t *piles;
+  size_t *links;
+  size_t *lengths;
+};
+
+static struct patience_piles *
+deal_piles (const void *base, size_t nmemb, size_t size,
+            compar_t *compar, void *arg)
+{
+  struct patience_piles *p = allocate (sizeof (struct patience_piles));
+  exit_if_out_of_memory (p != NULL);
+  p->base = base;
+  p->nmemb = nmemb;
+  p->size = size;
+  p->compar = NULL;
+  p->compar_r = NULL;
+  p->arg = arg;
+  p->merge = NULL;
+  p->allocator = patience_sort_allocator;
+  p->merged = false;
+  p->num_piles = 0;
+  p->piles = NULL;
+  p->links = NULL;
+  p->lengths = NULL;
+  if (nmemb != 0)
+    {
+      struct pile *piles = NULL;
+      size_t capacity = 0;
+      p->links = allocate (nmemb * sizeof (size_t));
+      exit_if_out_of_memory (p->links != NULL);
+      exit_if_out_of_memory (patience_sort_deal (base, nmemb, size,
+                                                 compar, arg, SIZE_MAX,
+                                                 false, &p->num_piles,
+                                                 &piles, &capacity,
+                                                 p->links)
+                             != DEAL_FAILED);
+      p->piles = allocate (p->num_piles * sizeof (size_t));
+      p->lengths = allocate (p->num_piles * sizeof (size_t));
+      exit_if_out_of_memory (p->piles != NULL && p->lengths != NULL);
+      for (size_t i = 0; i != p->num_piles; i += 1)
+        {
+          p->piles[i] = piles[i].head;
+          p->lengths[i] = piles[i].length;
+        }
+      release (piles, capacity * sizeof (struct pile));
+    }
+  return p;
+}
+
+static void
+merge_dealt_piles (struct patience_piles *p, compar_t *compar,
+                   size_t *indices, void *elements)
+{
+  /* The merge uses up the piles, so it is done only once. */
+  if (!p->merged && p->num_piles != 0)
+    {
+      const size_t winners_bytes =
+        (tree_bytes (p->num_piles, NULL) != 0) ?
+        tree_bytes (p->num_piles, NULL) : 1;
+      size_t *winners = allocate (winners_bytes);
+      exit_if_out_of_memory (winners != NULL);
+      k_way_merge (p->base, p->nmemb, p->size, compar, NULL, p->arg,
+                   p->num_piles, p->piles, p->links, winners,
+                   indices, elements);
+      release (winners, winners_bytes);
+    }
+  p->merged = true;
+}
+
+#endif /* !PATIENCE_SORT_STATS */
+
+static bool
+try_sort_in_place (void *base, size_t nmemb, size_t size,
+                   compar_t *compar, keyfn_t *key, void *arg)
+{
+  /* Sort out of place, then move the result to the original array.
+     Return false, leaving the array as it was, if memory runs out. */
+
+  bool ok;
+  if (nmemb * size <= LEN_THRESHOLD * sizeof (size_t))
+    {
+      char buffer[nmemb * size];
+      ok = try_sort_out_of_place (base, nmemb, size, compar, key, arg,
+                                  NULL, buffer);
+      if (ok)
+        memcpy (base, buffer, nmemb * size);
+    }
+  else
+    {
+      void *buffer = workspace_alloc (nmemb * size);
+      ok = (buffer != NULL
+            && try_sort_out_of_place (base, nmemb, size, compar, key,
+                                      arg, NULL, buffer));
+      if (!ok)
+        {
+          /* Leave the array alone. */
+        }
+      else if (PATIENCE_SORT_STREAM_MIN_BYTES / size <= nmemb)
+        {
+          stream_copy (base, buffer, nmemb * size);
+          stream_fence ();
+        }
+      else
+        memcpy (base, buffer, nmemb * size);
+      workspace_free (buffer, nmemb * size);
+    }
+  return ok;
+}
+
+static void
+sort_in_place (void *base, size_t nmemb, size_t size,
+               compar_t *compar, keyfn_t *key, void *arg)
+{
+  exit_if_out_of_memory (try_sort_in_place (base, nmemb, size,
+                                            compar, key, arg));
+}
+
+#if !PATIENCE_SORT_STATS
+
+/*
+  Work shared among threads. Each is given a number, from 0 for the
+  thread that called up to num_threads - 1, and the settings of the
+  thread that called. If a thread cannot be started, the thread that
+  called does its share, after its own.
+*/
+struct worker
+{
+  void (*work) (void *ctx, size_t t);
+  void *ctx;
+  size_t t;
+  size_t max_piles;
+  enum patience_merge_planner merge_planner;
+  bool prefault;
+  struct allocator allocator;
+};
+
+#if HAVE_PTHREAD_CREATE
+
+static void *
+worker_thread (void *p)
+{
+  const struct worker *w = p;
+  patience_sort_max_piles = w->max_piles;
+  patience_sort_merge_planner = w->merge_planner;
+  patience_sort_prefault = w->prefault;
+  patience_sort_allocator = w->allocator;
+  w->work (w->ctx, w->t);
+  return NULL;
+}
+
+#endif
+
+static void
+run_threads (size_t num_threads, void (*work) (void *ctx, size_t t),
+             void *ctx)
+{
+#if HAVE_PTHREAD_CREATE
+  struct worker workers[num_threads];
+  pthread_t threads[num_threads];
+  bool started[num_threads];
+  for (size_t t = 1; t < num_threads; t += 1)
+    {
+      workers[t].work = work;
+      workers[t].ctx = ctx;
+      workers[t].t = t;
+      workers[t].max_piles = patience_sort_max_piles;
+      workers[t].merge_planner = patience_sort_merge_planner;
+      workers[t].prefault = patience_sort_prefault;
+      workers[t].allocator = patience_sort_allocator;
+      started[t] = (pthread_create (&threads[t], NULL, worker_thread,
+                                    &workers[t]) == 0);
+    }
+  work (ctx, 0);
+  for (size_t t = 1; t < num_threads; t += 1)
+    {
+      if (started[t])
+        (void) pthread_join (threads[t], NULL);
+      else
+        work (ctx, t);
+    }
+#else
+  for (size_t t = 0; t < num_threads; t += 1)
+    work (ctx, t);
+#endif
+}
+
+/* Arrays of a batch with up to this many elements are sorted in a
+   workspace the batch shares. Longer ones are sorted one at a
+   time. */
+#define BATCH_LEN_MAX   1024
+
+/* Arrays of a batch with up to this many elements are insertion
+   sorted. */
+#define BATCH_TINY_LEN  32
+
+/* The arrays of a batch are handed out this many at a time. The
+   segments of a segmented sort are handed out by the elements in
+   them, so that a few long segments do not all go to one thread. */
+#define BATCH_CHUNK     64
+#define SEGMENT_CHUNK_ELEMENTS (16 * 1024)
+
+/* A batch is spread over one more thread for each this many elements
+   in it, up to the number of threads allowed. */
+#define BATCH_THREAD_MIN_ELEMENTS (64 * 1024)
+
+/*
+  A batch is either an array of entries, or the segments of one
+  array, marked off by offsets. The segments of a segmented sort are
+  sorted into the same places in indices or elements, relative to
+  their own beginnings, or else back into the array.
+
+  The arrays are sorted one after another. Their deals are not
+  interleaved, probe by probe, to overlap cache misses: the searches
+  of a deal probe the elements dealt most recently, which are still
+  in cache, so that sorts of arrays this short wait on comparisons
+  rather than memory. That was measured only for arrays of 100 to
+  1000 ints. Batches of arrays too large for the cache, which are
+  longer than BATCH_LEN_MAX and so are sorted one at a time, were not
+  evaluated; interleaving might pay there.
+*/
+struct batch
+{
+  const struct patience_batch_entry *entries;
+  size_t count;                 /* The number of entries or
+                                   segments. */
+  compar_t *compar;
+  void *arg;
+
+  const char *base;             /* For segments. */
+  size_t size;
+  const size_t *offsets;
+  size_t *indices;
+  char *elements;
+  bool in_place;
+
+  size_t total;                 /* The number of elements. */
+  size_t end;                   /* Where the last segment ends. */
+  size_t max_len;               /* The longest array to share the
+                                   workspace. */
+
+  atomic_size_t next;           /* The next entry, or element, to
+                                   hand out. */
+  atomic_bool failed;           /* Whether memory ran out. */
+};
+
+static void
+sort_tiny (const void *base, size_t nmemb, size_t size,
+           compar_t *compar, void *arg, size_t *order,
+           size_t *indices, void *elements)
+{
+  /* Insertion sort element numbers into order, which has room for
+     nmemb of them, and output by them. For an array this short,
+     dealing and merging costs more than it saves. */
+
+  for (size_t i = 0; i != nmemb; i += 1)
+    {
+      const char *const x = ((const char *) base) + i * size;
+      size_t j = i;
+      while (j != 0
+             && COMPAR (x, ((const char *) base) + order[j - 1] * size,
+                        arg) < 0)
+        {
+          order[j] = order[j - 1];
+          j -= 1;
+        }
+      order[j] = i;
+    }
+  if (indices != NULL)
+    memcpy (indices, order, nmemb * sizeof (size_t));
+  if (elements != NULL)
+    for (size_t k = 0; k != nmemb; k += 1)
+      memcpy (((char *) elements) + k * size,
+              ((const char *) base) + order[k] * size, size);
+}
+
+static size_t
+batch_tree_bytes (size_t max_len)
+{
+  /* Room for the tree of any number of piles up to max_len. */
+  const size_t power = next_power_of_two (max_len);
+  const size_t blocked = blocked_tree_bytes (power);
+  const size_t plain = 4 * power * sizeof (size_t);
+  return (blocked < plain) ? plain : blocked;
+}
+
+static size_t
+first_segment_from (const size_t *offsets, size_t count, size_t i)
+{
+  /* The first segment that begins at or after element i. */
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo != hi)
+    {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (offsets[mid] < i)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+static bool
+batch_claim (struct batch *b, size_t *first, size_t *last)
+{
+  /* Hand out the next entries, or the segments that begin among the
+     next elements. Return false when there are none left. */
+  bool claimed;
+  if (b->entries != NULL)
+    {
+      *first = atomic_fetch_add (&b->next, BATCH_CHUNK);
+      claimed = (*first < b->count);
+      if (claimed)
+        *last = ((b->count - *first < BATCH_CHUNK) ?
+                 b->count : *first + BATCH_CHUNK);
+    }
+  else
+    {
+      const size_t i =
+        atomic_fetch_add (&b->next, SEGMENT_CHUNK_ELEMENTS);
+      claimed = (i < b->end);
+      if (claimed)
+        {
+          const size_t j =
+            (b->end - i < SEGMENT_CHUNK_ELEMENTS) ?
+            b->end : i + SEGMENT_CHUNK_ELEMENTS;
+          *first = first_segment_from (b->offsets, b->count, i);
+          *last = first_segment_from (b->offsets, b->count, j);
+        }
+    }
+  return claimed;
+}
+
+static void
+run_batch (struct batch *b)
+{
+  /* Sort arrays of the batch, a chunk at a time, until they run out
+     or some thread runs out of memory. The tree comes first in the
+     workspace, where the blocked tree wants it, and a buffer for
+     sorting in place comes last. */
+
+  const size_t max_len = b->max_len;
+  const size_t tree_bytes = batch_tree_bytes (max_len);
+  const size_t buffer_bytes = (b->in_place) ? max_len * b->size : 0;
+  const size_t workspace_bytes =
+    tree_bytes + max_len * (sizeof (struct pile) + 2 * sizeof (size_t))
+    + buffer_bytes;
+  char *const workspace =
+    (max_len == 0) ? NULL : allocate (workspace_bytes);
+
+  size_t *const winners = (size_t *) workspace;
+  struct pile *const piles = (struct pile *) (workspace + tree_bytes);
+  size_t *const heads = (size_t *) (piles + max_len);
+  size_t *const links = heads + max_len;
+  char *const buffer = (char *) (links + max_len);
+
+  bool ok = (max_len == 0 || workspace != NULL);
+  size_t first;
+  size_t last;
+  while (ok && !atomic_load (&b->failed)
+         && batch_claim (b, &first, &last))
+    for (size_t i = first; ok && i != last; i += 1)
+      {
+        const void *base;
+        size_t nmemb;
+        size_t size;
+        size_t *indices = NULL;
+        void *elements = NULL;
+        if (b->entries != NULL)
+          {
+            base = b->entries[i].base;
+            nmemb = b->entries[i].nmemb;
+            size = b->entries[i].size;
+            elements = b->entries[i].result;
+          }
+        else
+          {
+            const size_t offset = b->offsets[i];
+            size = b->size;
+            base = b->base + offset * size;
+            nmemb = b->offsets[i + 1] - offset;
+            if (b->indices != NULL)
+              indices = b->indices + offset;
+            else if (!b->in_place)
+              elements = b->elements + offset * size;
+          }
+
+        const bool shared = (nmemb <= max_len
+                             && !piles_are_capped (nmemb,
+                                                   patience_sort_max_piles));
+        if (nmemb <= 1)
+          {
+            if (nmemb == 0 || b->in_place)
+              {
+                /* Do nothing. */
+              }
+            else if (indices != NULL)
+              indices[0] = 0;
+            else
+              memcpy (elements, base, size);
+          }
+        else if (nmemb <= BATCH_TINY_LEN)
+          {
+            sort_tiny (base, nmemb, size, b->compar, b->arg, links,
+                       indices, (b->in_place) ? buffer : elements);
+            if (b->in_place)
+              memcpy ((void *) base, buffer, nmemb * size);
+          }
+        else if (b->in_place && shared)
+          {
+            sort_short (base, nmemb, size, b->compar, b->arg,
+                        piles, heads, links, winners, NULL, buffer);
+            memcpy ((void *) base, buffer, nmemb * size);
+          }
+        else if (b->in_place)
+          ok = try_sort_in_place ((void *) base, nmemb, size,
+                                  b->compar, NULL, b->arg);
+        else if (shared)
+          sort_short (base, nmemb, size, b->compar, b->arg,
+                      piles, heads, links, winners, indices, elements);
+        else
+          ok = try_sort_out_of_place (base, nmemb, size, b->compar,
+                                      NULL, b->arg, indices, elements);
+      }
+  release (workspace, workspace_bytes);
+
+  if (!ok)
+    atomic_store (&b->failed, true);
+}
+
+static void
+batch_work (void *b, size_t t)
+{
+  /* Every thread takes its work from the batch, whatever its
+     number. */
+  (void) t;
+  run_batch (b);
+}
+
+static void
+init_batch (struct batch *b, compar_t *compar, void *arg)
+{
+  b->entries = NULL;
+  b->count = 0;
+  b->compar = compar;
+  b->arg = arg;
+  b->base = NULL;
+  b->size = 0;
+  b->offsets = NULL;
+  b->indices = NULL;
+  b->elements = NULL;
+  b->in_place = false;
+  b->total = 0;
+  b->end = 0;
+  b->max_len = 0;
+  atomic_init (&b->next, 0);
+  atomic_init (&b->failed, false);
+}
+
+static void
+run_batch_threads (struct batch *b, size_t num_chunks)
+{
+  size_t num_threads = 1 + (b->total / BATCH_THREAD_MIN_ELEMENTS);
+  if (patience_sort_num_threads < num_threads)
+    num_threads = patience_sort_num_threads;
+  if (num_chunks < num_threads)
+    num_threads = (num_chunks == 0) ? 1 : num_chunks;
+
+  /* A thread that could not be started finds nothing left to do when
+     the calling thread does its share. */
+  run_threads (num_threads, batch_work, b);
+  exit_if_out_of_memory (!atomic_load (&b->failed));
+}
+
+static void
+sort_batch (const struct patience_batch_entry *entries, size_t count,
+            compar_t *compar, void *arg)
+{
+  struct batch b;
+  init_batch (&b, compar, arg);
+  b.entries = entries;
+  b.count = count;
+  for (size_t i = 0; i != count; i += 1)
+    {
+      const size_t nmemb = entries[i].nmemb;
+      b.total += nmemb;
+      if (b.max_len < nmemb && nmemb <= BATCH_LEN_MAX)
+        b.max_len = nmemb;
+    }
+  run_batch_threads (&b, (count + BATCH_CHUNK - 1) / BATCH_CHUNK);
+}
+
+static void
+sort_segments (const void *base, size_t size, const size_t *offsets,
+               size_t nsegments, compar_t *compar, void *arg,
+               size_t *indices, void *elements)
+{
+  /* Sort into indices, or elements, or, if both are NULL, in
+     place. */
+  struct batch b;
+  init_batch (&b, compar, arg);
+  b.count = nsegments;
+  b.base = base;
+  b.size = size;
+  b.offsets = offsets;
+  b.indices = indices;
+  b.elements = elements;
+  b.in_place = (indices == NULL && elements == NULL);
+  for (size_t i = 0; i != nsegments; i += 1)
+    {
+      const size_t nmemb = offsets[i + 1] - offsets[i];
+      if (b.max_len < nmemb && nmemb <= BATCH_LEN_MAX)
+        b.max_len = nmemb;
+    }
+
+  /* The elements are handed out from the first segment's
+     beginning. */
+  if (nsegments != 0)
+    {
+      atomic_init (&b.next, offsets[0]);
+      b.end = offsets[nsegments];
+      b.total = b.end - offsets[0];
+    }
+  run_batch_threads (&b,
+                     (b.total + SEGMENT_CHUNK_ELEMENTS - 1)
+                     / SEGMENT_CHUNK_ELEMENTS);
+}
+
+/*
+  A parallel sort samples splitters, puts each element in the bucket
+  between two of them, and then sorts the buckets at once, one to a
+  thread, each into its own stretch of the result. There is no merge
+  at the end. The splitters are ordered as beats orders elements, by
+  value and then by place in the array, so that a run of equal
+  elements is split between buckets in the order it came in, and the
+  sort stays stable. Each thread puts its own share of the array in
+  the buckets, in order, so that each bucket keeps the order of the
+  array too.
+*/
+
+/* A parallel sort is spread over one more thread for each
+   BATCH_THREAD_MIN_ELEMENTS elements, as a batch is. The splitters
+   are chosen from this many samples for each bucket. */
+#define SAMPLES_PER_BUCKET 32
+
+struct sample_sort
+{
+  const char *base;
+  size_t nmemb;
+  size_t size;
+  compar_t *compar;
+  void *arg;
+
+  size_t num_buckets;           /* One to a thread. */
+  const size_t *splitters;      /* num_buckets - 1 element numbers,
+                                   counting from 1, in order. */
+  uint16_t *buckets;            /* Which bucket each element is in. */
+  size_t *counts;               /* By thread and bucket: how many
+                                   elements, then where the next
+                                   one goes. */
+  size_t *starts;               /* Where each bucket begins, and
+                                   where the last one ends. */
+  char *scratch;                /* The elements, bucket by bucket. */
+  size_t *places;               /* Where they were, for indices. */
+
+  size_t *indices;
+  char *elements;
+  atomic_bool failed;           /* Whether memory ran out. */
+};
+
+static size_t
+share_begins (size_t nmemb, size_t num_shares, size_t t)
+{
+  /* Where share t of nmemb things begins, the shares differing in
+     size by one at most. */
+  const size_t q = nmemb / num_shares;
+  const size_t r = nmemb % num_shares;
+  return (t * q) + ((t < r) ? t : r);
+}
+
+static void
+classify_elements (void *ctx, size_t t)
+{
+  struct sample_sort *s = ctx;
+  const size_t num_buckets = s->num_buckets;
+  size_t *const counts = s->counts + t * num_buckets;
+  const size_t last = share_begins (s->nmemb, num_buckets, t + 1);
+
+  for (size_t b = 0; b != num_buckets; b += 1)
+    counts[b] = 0;
+  for (size_t i = share_begins (s->nmemb, num_buckets, t);
+       i != last; i += 1)
+    {
+      /* Find the first splitter that element i + 1 beats. */
+      size_t lo = 0;
+      size_t hi = num_buckets - 1;
+      while (lo != hi)
+        {
+          const size_t mid = lo + (hi - lo) / 2;
+          if (beats (s->base, s->size, s->compar, s->arg,
+                     s->splitters[mid], i + 1))
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+      s->buckets[i] = lo;
+      counts[lo] += 1;
+    }
+}
+
+static void
+scatter_elements (void *ctx, size_t t)
+{
+  struct sample_sort *s = ctx;
+  const size_t size = s->size;
+  size_t *const next = s->counts + t * s->num_buckets;
+  const size_t last = share_begins (s->nmemb, s->num_buckets, t + 1);
+
+  for (size_t i = share_begins (s->nmemb, s->num_buckets, t);
+       i != last; i += 1)
+    {
+      const size_t k = next[s->buckets[i]];
+      next[s->buckets[i]] = k + 1;
+      memcpy (s->scratch + k * size, s->base + i * size, size);
+      if (s->places != NULL)
+        s->places[k] = i;
+    }
+}
+
+static void
+sort_bucket (void *ctx, size_t b)
+{
+  struct sample_sort *s = ctx;
+  const size_t start = s->starts[b];
+  const size_t n = s->starts[b + 1] - start;
+  size_t *const indices =
+    (s->indices == NULL) ? NULL : s->indices + start;
+  char *const elements =
+    (s->elements == NULL) ? NULL : s->elements + start * s->size;
+
+  bool ok = try_sort_out_of_place (s->scratch + start * s->size, n,
+                                   s->size, s->compar, NULL, s->arg,
+                                   indices, elements);
+  if (ok && indices != NULL)
+    for (size_t k = 0; k != n; k += 1)
+      indices[k] = s->places[start + indices[k]];
+  if (!ok)
+    atomic_store (&s->failed, true);
+}
+
+static void
+sort_parallel (const void *base, size_t nmemb, size_t size,
+               compar_t *compar, void *arg,
+               size_t *indices, void *elements)
+{
+  size_t num_buckets = 1 + (nmemb / BATCH_THREAD_MIN_ELEMENTS);
+  if (patience_sort_num_threads < num_buckets)
+    num_buckets = patience_sort_num_threads;
+  if (UINT16_MAX < num_buckets)
+    num_buckets = UINT16_MAX;
+
+  if (num_buckets == 1)
+    sort_out_of_place (base, nmemb, size, compar, NULL, arg,
+                       indices, elements);
+  else
+    {
+      struct sample_sort s;
+      s.base = base;
+      s.nmemb = nmemb;
+      s.size = size;
+      s.compar = compar;
+      s.arg = arg;
+      s.num_buckets = num_buckets;
+      s.indices = indices;
+      s.elements = elements;
+      atomic_init (&s.failed, false);
+
+      /* Sort evenly spaced samples, by their indices so that equal
+         ones stay in the order of the array, and take every
+         SAMPLES_PER_BUCKET-th as a splitter. There are fewer samples
+         than elements, because there are at least
+         BATCH_THREAD_MIN_ELEMENTS elements for each bucket after the
+         first. */
+      const size_t num_samples = num_buckets * SAMPLES_PER_BUCKET;
+      const size_t samples_bytes = num_samples * size;
+      const size_t order_bytes = num_samples * sizeof (size_t);
+      const size_t splitters_bytes = (num_buckets - 1) * sizeof (size_t);
+      char *samples = allocate (samples_bytes);
+      size_t *order = allocate (order_bytes);
+      size_t *splitters = allocate (splitters_bytes);
+      exit_if_out_of_memory (samples != NULL && order != NULL
+                             && splitters != NULL);
+      for (size_t j = 0; j != num_samples; j += 1)
+        memcpy (samples + j * size,
+                ((const char *) base)
+                + share_begins (nmemb, num_samples, j) * size,
+                size);
+      sort_out_of_place (samples, num_samples, size, compar, NULL, arg,
+                         order, NULL);
+      for (size_t b = 1; b != num_buckets; b += 1)
+        splitters[b - 1] =
+          share_begins (nmemb, num_samples,
+                        order[b * SAMPLES_PER_BUCKET]) + 1;
+      s.splitters = splitters;
+      release (samples, samples_bytes);
+      release (order, order_bytes);
+
+      const size_t buckets_bytes = nmemb * sizeof (uint16_t);
+      const size_t counts_bytes =
+        num_buckets * num_buckets * sizeof (size_t);
+      const size_t starts_bytes = (num_buckets + 1) * sizeof (size_t);
+      const size_t scratch_bytes = nmemb * size;
+      const size_t places_bytes =
+        (indices == NULL) ? 0 : nmemb * sizeof (size_t);
+      s.buckets = workspace_alloc (buckets_bytes);
+      s.counts = allocate (counts_bytes);
+      s.starts = allocate (starts_bytes);
+      s.scratch = workspace_alloc (scratch_bytes);
+      s.places = (indices == NULL) ? NULL : workspace_alloc (places_bytes);
+      exit_if_out_of_memory (s.buckets != NULL && s.counts != NULL
+                             && s.starts != NULL && s.scratch != NULL
+                             && (indices == NULL || s.places != NULL));
+
+      run_threads (num_buckets, classify_elements, &s);
+
+      /* Each thread's elements of a bucket go after those of the
+         threads before it. */
+      size_t k = 0;
+      for (size_t b = 0; b != num_buckets; b += 1)
+        {
+          s.starts[b] = k;
+          for (size_t t = 0; t != num_buckets; t += 1)
+            {
+              const size_t count = s.counts[t * num_buckets + b];
+              s.counts[t * num_buckets + b] = k;
+              k += count;
+            }
+        }
+      s.starts[num_buckets] = k;
+
+      run_threads (num_buckets, scatter_elements, &s);
+      workspace_free (s.buckets, buckets_bytes);
+      release (s.counts, counts_bytes);
+
+      run_threads (num_buckets, sort_bucket, &s);
+      release (splitters, splitters_bytes);
+      release (s.starts, starts_bytes);
+      workspace_free (s.scratch, scratch_bytes);
+      workspace_free (s.places, places_bytes);
+      exit_if_out_of_memory (!atomic_load (&s.failed));
+    }
+}
+
+/*
+  A sorter takes elements from several producer threads at once and
+  gives them back sorted. Each producer has a slot of its own, which
+  no other thread touches until the drain, so pushing takes no locks.
+  Once enough has been pushed to a slot, the producer sorts what is
+  new in it, as one more run of the slot, so that the producers do
+  most of the sorting between them. The drain sorts what is left the
+  same way, puts the slots one after another, links each run as a
+  pile, and merges all of the piles through one tournament. Ties go
+  to the earlier element of the slots so put together, that is, by
+  producer and then by the order pushed.
+*/
+
+/* What is new in a slot is sorted when there are at least this many
+   elements, and at least as many as were sorted before. Sorts that
+   grow as the slot does leave it with few runs, and the drain's
+   tournament small. */
+#define SORTER_SORT_MIN 4096
+
+/* Each slot has a cache line, or lines, to itself, so that producers
+   pushing to neighboring slots do not write to the same line. */
+#define SLOT_ALIGN 64
+
+struct sorter_slot
+{
+  _Alignas (SLOT_ALIGN) char *elements;
+  size_t count;
+  size_t capacity;
+  size_t sorted;                /* Elements before this are in
+                                   runs. */
+  size_t *runs;                 /* Where each run begins. */
+  size_t num_runs;
+  size_t runs_capacity;
+};
+
+struct patience_sorter
+{
+  size_t size;
+  int (*compar) (const void *, const void *);
+  int (*compar_r) (const void *, const void *, void *);
+  void *arg;
+  void (*push) (struct patience_sorter *, size_t, const void *, size_t);
+  void (*drain) (struct patience_sorter *, void *);
+  struct allocator allocator;   /* What the slots are allocated by. */
+  size_t num_producers;
+  struct sorter_slot *slots;
+  void *slots_memory;           /* Where the slots were allocated,
+                                   before aligning them. */
+};
+
+static size_t
+sorter_slots_bytes (size_t num_producers)
+{
+  return (num_producers * sizeof (struct sorter_slot)) + SLOT_ALIGN - 1;
+}
+
+static struct allocator
+use_allocator (struct allocator a)
+{
+  /* Have this thread allocate as a sorter does, returning what it
+     allocated by before. */
+  const struct allocator previous = patience_sort_allocator;
+  patience_sort_allocator = a;
+  return previous;
+}
+
+static struct patience_sorter *
+new_sorter (size_t size, size_t num_producers, void *arg)
+{
+  struct patience_sorter *s = allocate (sizeof (struct patience_sorter));
+  char *memory = allocate (sorter_slots_bytes (num_producers));
+  exit_if_out_of_memory (s != NULL && memory != NULL);
+
+  /* Start the slots on a line boundary. */
+  const uintptr_t address = (uintptr_t) memory;
+  struct sorter_slot *slots =
+    (struct sorter_slot *)
+    (memory + ((SLOT_ALIGN - (address % SLOT_ALIGN)) % SLOT_ALIGN));
+  memset (slots, 0, num_producers * sizeof (struct sorter_slot));
+  s->size = size;
+  s->compar = NULL;
+  s->compar_r = NULL;
+  s->arg = arg;
+  s->push = NULL;
+  s->drain = NULL;
+  s->allocator = patience_sort_allocator;
+  s->num_producers = num_producers;
+  s->slots = slots;
+  s->slots_memory = memory;
+  return s;
+}
+
+static void *
+grow_array (void *p, size_t used_bytes, size_t old_bytes,
+            size_t new_bytes)
+{
+  void *q = allocate (new_bytes);
+  exit_if_out_of_memory (q != NULL);
+  if (used_bytes != 0)
+    memcpy (q, p, used_bytes);
+  release (p, old_bytes);
+  return q;
+}
+
+static void
+sort_slot (struct sorter_slot *slot, size_t size, compar_t *compar,
+           void *arg)
+{
+  /* Sort the elements not yet sorted, stably, and put them back in
+     order as one more run, so that the drain's merge reads them
+     straight through. Equal elements keep their order in the slot. */
+  const size_t first = slot->sorted;
+  const size_t n = slot->count - first;
+  if (n != 0)
+    {
+      if (slot->num_runs == slot->runs_capacity)
+        {
+          const size_t capacity = (slot->runs_capacity == 0) ?
+            SMALL_K_MAX : 2 * slot->runs_capacity;
+          slot->runs = grow_array (slot->runs,
+                                   slot->num_runs * sizeof (size_t),
+                                   slot->runs_capacity * sizeof (size_t),
+                                   capacity * sizeof (size_t));
+          slot->runs_capacity = capacity;
+        }
+
+      char *const stretch = slot->elements + first * size;
+      char *sorted = workspace_alloc (n * size);
+      exit_if_out_of_memory (sorted != NULL);
+      sort_out_of_place (stretch, n, size, compar, NULL, arg,
+                         NULL, sorted);
+      memcpy (stretch, sorted, n * size);
+      workspace_free (sorted, n * size);
+      slot->runs[slot->num_runs] = first;
+      slot->num_runs += 1;
+    }
+  slot->sorted = slot->count;
+}
+
+static void
+sorter_push (struct patience_sorter *s, compar_t *compar,
+             size_t producer, const void *elements, size_t nmemb)
+{
+  const struct allocator previous = use_allocator (s->allocator);
+  struct sorter_slot *slot = &s->slots[producer];
+  const size_t size = s->size;
+
+  if (slot->capacity - slot->count < nmemb)
+    {
+      size_t capacity = (slot->capacity == 0) ?
+        SORTER_SORT_MIN : 2 * slot->capacity;
+      while (capacity - slot->count < nmemb)
+        capacity *= 2;
+      slot->elements = grow_array (slot->elements, slot->count * size,
+                                   slot->capacity * size,
+                                   capacity * size);
+      slot->capacity = capacity;
+    }
+  if (nmemb != 0)
+    memcpy (slot->elements + slot->count * size, elements, nmemb * size);
+  slot->count += nmemb;
+
+  if (SORTER_SORT_MIN <= slot->count - slot->sorted
+      && slot->sorted <= slot->count - slot->sorted)
+    sort_slot (slot, size, compar, s->arg);
+  (void) use_allocator (previous);
+}
+
+static size_t
+sorter_count (const struct patience_sorter *s)
+{
+  size_t total = 0;
+  for (size_t p = 0; p != s->num_producers; p += 1)
+    total += s->slots[p].count;
+  return total;
+}
+
+static void
+sorter_drain (struct patience_sorter *s, compar_t *compar, void *result)
+{
+  const struct allocator previous = use_allocator (s->allocator);
+  const size_t size = s->size;
+  const size_t nmemb = sorter_count (s);
+
+  size_t num_piles = 0;
+  for (size_t p = 0; p != s->num_producers; p += 1)
+    {
+      sort_slot (&s->slots[p], size, compar, s->arg);
+      num_piles += s->slots[p].num_runs;
+    }
+
+  if (nmemb != 0)
+    {
+      const size_t elements_bytes = nmemb * size;
+      const size_t links_bytes = nmemb * sizeof (size_t);
+      const size_t heads_bytes = num_piles * sizeof (size_t);
+      char *elements = workspace_alloc (elements_bytes);
+      size_t *links = workspace_alloc (links_bytes);
+      size_t *heads = allocate (heads_bytes);
+      exit_if_out_of_memory (elements != NULL && links != NULL
+                             && heads != NULL);
+
+      /* Put the slots one after another, and link each run, from
+         its first element to its last, as a pile. */
+      size_t offset = 0;
+      size_t k = 0;
+      for (size_t p = 0; p != s->num_producers; p += 1)
+        {
+          struct sorter_slot *slot = &s->slots[p];
+          if (slot->count != 0)
+            memcpy (elements + offset * size, slot->elements,
+                    slot->count * size);
+          for (size_t i = 0; i != slot->num_runs; i += 1)
+            {
+              const size_t begin = offset + slot->runs[i];
+              const size_t end = (i + 1 == slot->num_runs) ?
+                offset + slot->count : offset + slot->runs[i + 1];
+              for (size_t j = begin; j != end - 1; j += 1)
+                links[j] = j + 2;
+              links[end - 1] = LINK_NIL;
+              heads[k + i] = begin + 1;
+            }
+          offset += slot->count;
+          k += slot->num_runs;
+          slot->count = 0;
+          slot->sorted = 0;
+          slot->num_runs = 0;
+        }
+
+      exit_if_out_of_memory (merge_all (elements, nmemb, size, compar,
+                                        NULL, s->arg, num_piles, NULL,
+                                        heads, links, NULL, result));
+      workspace_free (elements, elements_bytes);
+      workspace_free (links, links_bytes);
+      release (heads, heads_bytes);
+    }
+  (void) use_allocator (previous);
+}
+
+/*
+  A job sorts a slice at a time, so that a thread with other things
+  to do, such as an event loop, can sort a large array between them.
+  The array is first sorted a run of JOB_RUN_LEN elements at a time,
+  into a copy, where the merge can read each run straight through.
+  The step that sorts the last run also builds the tournament over
+  the runs, which takes only a game for each of them, and then the
+  merge outputs a slice of the result at each step. Whatever a step
+  needs to go on from is kept in the job. The workspace is all
+  allocated when the job is made, including a workspace in which
+  sort_short sorts each run, so that a step neither allocates nor
+  can run out of memory.
+
+  Equal elements of different runs are in the copy in the order they
+  are in the array, and those of one run are kept in order by its
+  sort, so that the tournament's tie-break, by place in the copy,
+  keeps the sort stable.
+*/
+
+/* The runs are this long, and so a step sorting them does at least
+   this much work. */
+#define JOB_RUN_LEN 4096
+
+enum job_phase
+  {
+    JOB_RUNS,
+    JOB_MERGE,
+    JOB_DONE
+  };
+
+struct patience_job
+{
+  const void *base;
+  size_t nmemb;
+  size_t size;
+  int (*compar) (const void *, const void *);
+  int (*compar_r) (const void *, const void *, void *);
+  void *arg;
+  bool (*step) (struct patience_job *, size_t);
+  size_t *indices;
+  void *elements;
+  struct allocator allocator;   /* What the job is allocated by. */
+
+  enum job_phase phase;
+  size_t num_sorted;            /* Elements sorted into runs. */
+  size_t num_merged;            /* Elements output by the merge. */
+  char *runs;                   /* The array, a sorted run at a
+                                   time. */
+  size_t *places;               /* Where each element of the runs
+                                   was, if indices are wanted. */
+  char *workspace;              /* For sorting a run. */
+  size_t total_external_nodes;
+  size_t *winners;
+};
+
+static size_t
+job_run_len (size_t nmemb)
+{
+  return (nmemb < JOB_RUN_LEN) ? nmemb : JOB_RUN_LEN;
+}
+
+static size_t
+job_workspace_bytes (size_t run_len, bool with_order)
+{
+  /* The tree, the pile descriptors, heads and links, and the order
+     of the run if indices are wanted, for sort_short. */
+  return batch_tree_bytes (run_len)
+    + run_len * (sizeof (struct pile) + 2 * sizeof (size_t))
+    + ((with_order) ? run_len * sizeof (size_t) : 0);
+}
+
+static size_t
+job_winners_bytes (size_t total_external_nodes)
+{
+  /* The nodes are numbered from 1, and each has two fields. */
+  return 2 * (2 * total_external_nodes) * sizeof (size_t);
+}
+
+static struct patience_job *
+new_job (const void *base, size_t nmemb, size_t size, void *arg,
+         size_t *indices, void *elements)
+{
+  struct patience_job *job = allocate (sizeof (struct patience_job));
+  exit_if_out_of_memory (job != NULL);
+  job->base = base;
+  job->nmemb = nmemb;
+  job->size = size;
+  job->compar = NULL;
+  job->compar_r = NULL;
+  job->arg = arg;
+  job->step = NULL;
+  job->indices = indices;
+  job->elements = elements;
+  job->allocator = patience_sort_allocator;
+  job->phase = (nmemb == 0) ? JOB_DONE : JOB_RUNS;
+  job->num_sorted = 0;
+  job->num_merged = 0;
+  job->total_external_nodes =
+    next_power_of_two ((nmemb + JOB_RUN_LEN - 1) / JOB_RUN_LEN);
+  job->runs = NULL;
+  job->places = NULL;
+  job->workspace = NULL;
+  job->winners = NULL;
+  if (nmemb != 0)
+    {
+      job->runs = workspace_alloc (nmemb * size);
+      job->workspace =
+        allocate (job_workspace_bytes (job_run_len (nmemb),
+                                       indices != NULL));
+      job->winners =
+        allocate (job_winners_bytes (job->total_external_nodes));
+      if (indices != NULL)
+        job->places = workspace_alloc (nmemb * sizeof (size_t));
+      exit_if_out_of_memory (job->runs != NULL && job->workspace != NULL
+                             && job->winners != NULL
+                             && (indices == NULL || job->places != NULL));
+    }
+  return job;
+}
+
+static size_t
+job_next (size_t nmemb, size_t i)
+{
+  /* The element after i in its run, or LINK_NIL if i ends the
+     run. */
+  return (i % JOB_RUN_LEN == 0 || i == nmemb) ? LINK_NIL : i + 1;
+}
+
+static bool
+job_step (struct patience_job *job, compar_t *compar, size_t max_elements)
+{
+  /* Do about max_elements elements' worth of work, or the least a
+     phase can do, and return whether the job is done. */
+
+  const size_t nmemb = job->nmemb;
+  const size_t size = job->size;
+  void *const arg = job->arg;
+  char *const runs = job->runs;
+  size_t *const winners = job->winners;
+
+  if (job->phase == JOB_RUNS)
+    {
+      /* Sort whole runs, as many as fit the slice, but at least one,
+         in the workspace laid out as run_batch lays out its own. */
+      const size_t run_len = job_run_len (nmemb);
+      const size_t tree_bytes = batch_tree_bytes (run_len);
+      size_t *const tree = (size_t *) job->workspace;
+      struct pile *const piles =
+        (struct pile *) (job->workspace + tree_bytes);
+      size_t *const heads = (size_t *) (piles + run_len);
+      size_t *const links = heads + run_len;
+      size_t *const order =
+        (job->places == NULL) ? NULL : links + run_len;
+
+      size_t work = 0;
+      bool full = false;
+      while (job->num_sorted != nmemb && !full)
+        {
+          const size_t lo = job->num_sorted;
+          const size_t n =
+            (nmemb - lo < JOB_RUN_LEN) ? nmemb - lo : JOB_RUN_LEN;
+          full = (work != 0 && max_elements < work + n);
+          if (!full)
+            {
+              sort_short (((const char *) job->base) + lo * size, n,
+                          size, compar, arg, piles, heads, links, tree,
+                          order, runs + lo * size);
+              if (job->places != NULL)
+                for (size_t k = 0; k != n; k += 1)
+                  job->places[lo + k] = lo + order[k];
+              job->num_sorted += n;
+              work += n;
+            }
+        }
+      if (job->num_sorted == nmemb)
+        {
+          const size_t total_external_nodes = job->total_external_nodes;
+          memset (winners, LINK_NIL,
+                  job_winners_bytes (total_external_nodes));
+          for (size_t r = 0; r * JOB_RUN_LEN < nmemb; r += 1)
+            {
+              winners_set (winners, VALUE, total_external_nodes + r,
+                           r * JOB_RUN_LEN + 1);
+              winners_set (winners, LINK, total_external_nodes + r,
+                           r + 1);
+            }
+          build_tree (runs, size, compar, arg,
+                      total_external_nodes, winners);
+          job->phase = JOB_MERGE;
+        }
+    }
+  else if (job->phase == JOB_MERGE)
+    {
+      /* As merge does, but stopping after the slice, and without
+         galloping, which could output any number of elements. */
+      const size_t total_nodes = (2 * job->total_external_nodes) - 1;
+      size_t work = 0;
+      while (job->num_merged != nmemb
+             && (work == 0 || work < max_elements))
+        {
+          const size_t winner = winners_get (winners, VALUE, 1);
+          if (job->indices != NULL)
+            job->indices[job->num_merged] = job->places[winner - 1];
+          if (job->elements != NULL)
+            memcpy (((char *) job->elements) + job->num_merged * size,
+                    runs + (winner - 1) * size, size);
+          job->num_merged += 1;
+          work += 1;
+
+          const size_t i =
+            (total_nodes >> 1) + winners_get (winners, LINK, 1);
+          winners_set (winners, VALUE, i, job_next (nmemb, winner));
+          replay_games (runs, size, compar, arg, winners, i);
+        }
+      if (job->num_merged == nmemb)
+        job->phase = JOB_DONE;
+    }
+
+  return (job->phase == JOB_DONE);
+}
+
+#endif /* !PATIENCE_SORT_STATS */
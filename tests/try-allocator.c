@@ -0,0 +1,305 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <patience-sort.h>
+
+/*------------------------------------------------------------------*/
+/* A simple linear congruential generator.                          */
+
+/* The multiplier LCG_A comes from Steele, Guy; Vigna, Sebastiano (28
+   September 2021). "Computationally easy, spectrally good multipliers
+   for congruential pseudorandom number generators".
+   arXiv:2001.05304v3 [cs.DS] */
+#define LCG_A UINT64_C(0xf1357aea2e62a9c5)
+
+/* LCG_C must be odd. */
+#define LCG_C UINT64_C(0xbaceba11beefbead)
+
+uint64_t seed = 0;
+
+static double
+random_double (void)
+{
+  /* IEEE "binary64" or "double" has 52 bits of precision. We will
+     take the high 48 bits of the seed and divide it by 2**48, to get
+     a number 0.0 <= randnum < 1.0 */
+  const double high_48_bits = (double) (seed >> 16);
+  const double divisor = (double) (UINT64_C(1) << 48);
+  const double randnum = high_48_bits / divisor;
+
+  /* The following operation is modulo 2**64, by virtue of standard C
+     behavior for uint64_t. */
+  seed = (LCG_A * seed) + LCG_C;
+
+  return randnum;
+}
+
+static int
+random_int (int m, int n)
+{
+  return m + (int) (random_double () * (n - m + 1));
+}
+
+/*------------------------------------------------------------------*/
+
+#define CHECK(expr)                             \
+  if (expr)                                     \
+    {}                                          \
+  else                                          \
+    check_failed (__FILE__, __LINE__)
+
+static void
+check_failed (const char *file, unsigned int line)
+{
+  fprintf (stderr, "CHECK failed at %s:%u\n", file, line);
+  exit (1);
+}
+
+static int
+intcmp (const void *px, const void *py)
+{
+  const int x = *((const int *) px);
+  const int y = *((const int *) py);
+  return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+/*------------------------------------------------------------------*/
+/* An allocator that keeps count, and can be made to fail.          */
+
+struct arena
+{
+  size_t live_bytes;            /* Allocated and not yet freed. */
+  size_t num_allocs;            /* Successful allocations. */
+  size_t allocs_left;           /* Fail once this many have been
+                                   made. */
+};
+
+static void *
+arena_alloc (size_t size, void *ctx)
+{
+  /* Keep the size ahead of the block, to check what free is told. */
+  struct arena *a = ctx;
+  void *p = NULL;
+  if (a->allocs_left != 0)
+    {
+      char *block = malloc (size + 16);
+      if (block != NULL)
+        {
+          memcpy (block, &size, sizeof (size_t));
+          p = block + 16;
+          a->live_bytes += size;
+          a->num_allocs += 1;
+          a->allocs_left -= 1;
+        }
+    }
+  return p;
+}
+
+static void
+arena_free (void *ptr, size_t size, void *ctx)
+{
+  struct arena *a = ctx;
+  char *block = ((char *) ptr) - 16;
+  size_t allocated;
+  memcpy (&allocated, block, sizeof (size_t));
+  CHECK (allocated == size);
+  a->live_bytes -= size;
+  free (block);
+}
+
+/*------------------------------------------------------------------*/
+
+#define NUM_PATTERNS 4
+
+static int
+pattern_value (int pattern, size_t sz, size_t i)
+{
+  /* Random values, interleaved ascending sequences, few different
+     values, and a descending array. */
+  return
+    (pattern == 0) ? random_int (1, 1000000) :
+    (pattern == 1) ? (int) ((i % 20) * sz + i / 20) :
+    (pattern == 2) ? random_int (1, 10) :
+    (int) (sz - i);
+}
+
+static void
+test_arena (void)
+{
+  /* Everything a sort allocates comes from the arena and is given
+     back to it. */
+  const size_t sizes[] = { 0, 10, 1000, 100000 };
+  for (int pattern = 0; pattern != NUM_PATTERNS; pattern += 1)
+    for (size_t k = 0; k != sizeof sizes / sizeof sizes[0]; k += 1)
+      {
+        const size_t sz = sizes[k];
+        int *p1 = malloc (sz * sizeof (int));
+        int *p2 = malloc (sz * sizeof (int));
+        int *p3 = malloc (sz * sizeof (int));
+        size_t *p4 = malloc (sz * sizeof (size_t));
+
+        for (size_t i = 0; i < sz; i += 1)
+          p1[i] = pattern_value (pattern, sz, i);
+        for (size_t i = 0; i < sz; i += 1)
+          p2[i] = p1[i];
+        qsort (p2, sz, sizeof (int), intcmp);
+
+        struct arena a = { 0, 0, SIZE_MAX };
+        patience_sort_set_allocator (arena_alloc, arena_free, &a);
+
+        CHECK (patience_try_sort (p1, sz, sizeof (int), intcmp, p3) == 0);
+        CHECK (a.live_bytes == 0);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p3[i]);
+
+        CHECK (patience_try_sort_indices (p1, sz, sizeof (int), intcmp,
+                                          p4) == 0);
+        CHECK (a.live_bytes == 0);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p1[p4[i]]);
+
+        struct patience_piles *piles;
+        patience_deal (p1, sz, sizeof (int), intcmp, &piles);
+        CHECK (a.live_bytes != 0);
+        patience_merge_piles (piles, NULL, p3);
+        patience_piles_free (piles);
+        CHECK (a.live_bytes == 0);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p3[i]);
+
+        CHECK (patience_try_sort_in_place (p1, sz, sizeof (int),
+                                           intcmp) == 0);
+        CHECK (a.live_bytes == 0);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p1[i]);
+
+        CHECK (sz <= 128 || a.num_allocs != 0);
+        patience_sort_set_allocator (NULL, NULL, NULL);
+
+        free (p1);
+        free (p2);
+        free (p3);
+        free (p4);
+      }
+}
+
+static void
+test_out_of_memory (void)
+{
+  /* Let the arena fail at each allocation in turn. A sort either
+     succeeds, or returns ENOMEM having given back all it took, and
+     having left an array sorted in place as it was. */
+  const size_t sz = 100000;
+  for (int pattern = 0; pattern != NUM_PATTERNS; pattern += 1)
+    {
+      int *p1 = malloc (sz * sizeof (int));
+      int *p2 = malloc (sz * sizeof (int));
+      int *p3 = malloc (sz * sizeof (int));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = pattern_value (pattern, sz, i);
+      for (size_t i = 0; i < sz; i += 1)
+        p2[i] = p1[i];
+      qsort (p2, sz, sizeof (int), intcmp);
+
+      int result = ENOMEM;
+      for (size_t n = 0; result == ENOMEM; n += 1)
+        {
+          struct arena a = { 0, 0, n };
+          patience_sort_set_allocator (arena_alloc, arena_free, &a);
+          result = patience_try_sort (p1, sz, sizeof (int), intcmp, p3);
+          patience_sort_set_allocator (NULL, NULL, NULL);
+          CHECK (result == 0 || result == ENOMEM);
+          CHECK (a.live_bytes == 0);
+        }
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p3[i]);
+
+      for (size_t i = 0; i < sz; i += 1)
+        p3[i] = p1[i];
+      result = ENOMEM;
+      for (size_t n = 0; result == ENOMEM; n += 1)
+        {
+          struct arena a = { 0, 0, n };
+          patience_sort_set_allocator (arena_alloc, arena_free, &a);
+          result = patience_try_sort_in_place (p3, sz, sizeof (int),
+                                               intcmp);
+          patience_sort_set_allocator (NULL, NULL, NULL);
+          CHECK (a.live_bytes == 0);
+          if (result == ENOMEM)
+            CHECK (memcmp (p1, p3, sz * sizeof (int)) == 0);
+        }
+      CHECK (result == 0);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p3[i]);
+
+      free (p1);
+      free (p2);
+      free (p3);
+    }
+}
+
+static void
+test_workspace_cache (void)
+{
+  /* Sorts of growing and shrinking sizes, one after another, take
+     buffers that earlier sorts left in the cache, and the cache must
+     fill up and let go of old buffers. None of that may show in the
+     results, and nor may turning the cache off and on. */
+  const size_t max_sz = 30000;
+  int *p1 = malloc (max_sz * sizeof (int));
+  int *p2 = malloc (max_sz * sizeof (int));
+  int *p3 = malloc (max_sz * sizeof (int));
+  for (int round = 0; round != 3; round += 1)
+    {
+      patience_sort_set_workspace_cache ((round == 1) ? 0 : SIZE_MAX);
+      for (size_t sz = 1; sz <= max_sz; sz += sz / 2 + 1)
+        for (int pattern = 0; pattern != NUM_PATTERNS; pattern += 1)
+          {
+            for (size_t i = 0; i < sz; i += 1)
+              p1[i] = pattern_value (pattern, sz, i);
+            for (size_t i = 0; i < sz; i += 1)
+              p2[i] = p1[i];
+            qsort (p2, sz, sizeof (int), intcmp);
+            patience_sort (p1, sz, sizeof (int), intcmp, p3);
+            for (size_t i = 0; i < sz; i += 1)
+              CHECK (p2[i] == p3[i]);
+            patience_sort_in_place (p1, sz, sizeof (int), intcmp);
+            for (size_t i = 0; i < sz; i += 1)
+              CHECK (p2[i] == p1[i]);
+          }
+    }
+  free (p1);
+  free (p2);
+  free (p3);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_arena ();
+  test_out_of_memory ();
+  test_workspace_cache ();
+  return 0;
+}
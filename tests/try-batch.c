@@ -0,0 +1,446 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <patience-sort.h>
+
+#if HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+
+/*------------------------------------------------------------------*/
+/* A simple linear congruential generator.                          */
+
+/* The multiplier LCG_A comes from Steele, Guy; Vigna, Sebastiano (28
+   September 2021). "Computationally easy, spectrally good multipliers
+   for congruential pseudorandom number generators".
+   arXiv:2001.05304v3 [cs.DS] */
+#define LCG_A UINT64_C(0xf1357aea2e62a9c5)
+
+/* LCG_C must be odd. */
+#define LCG_C UINT64_C(0xbaceba11beefbead)
+
+uint64_t seed = 0;
+
+static double
+random_double (void)
+{
+  /* IEEE "binary64" or "double" has 52 bits of precision. We will
+     take the high 48 bits of the seed and divide it by 2**48, to get
+     a number 0.0 <= randnum < 1.0 */
+  const double high_48_bits = (double) (seed >> 16);
+  const double divisor = (double) (UINT64_C(1) << 48);
+  const double randnum = high_48_bits / divisor;
+
+  /* The following operation is modulo 2**64, by virtue of standard C
+     behavior for uint64_t. */
+  seed = (LCG_A * seed) + LCG_C;
+
+  return randnum;
+}
+
+static int
+random_int (int m, int n)
+{
+  return m + (int) (random_double () * (n - m + 1));
+}
+
+/*------------------------------------------------------------------*/
+
+#define CHECK(expr)                             \
+  if (expr)                                     \
+    {}                                          \
+  else                                          \
+    check_failed (__FILE__, __LINE__)
+
+static void
+check_failed (const char *file, unsigned int line)
+{
+  fprintf (stderr, "CHECK failed at %s:%u\n", file, line);
+  exit (1);
+}
+
+static int
+intcmp (const void *px, const void *py)
+{
+  const int x = *((const int *) px);
+  const int y = *((const int *) py);
+  return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+static int
+intcmp_r (const void *px, const void *py, void *arg)
+{
+  /* Compare in descending order if *arg is nonzero. */
+  const int sign = (*((const int *) arg) != 0) ? -1 : 1;
+  return sign * intcmp (px, py);
+}
+
+/*------------------------------------------------------------------*/
+
+static int
+pattern_value (int pattern, size_t sz, size_t i)
+{
+  /* Random values, interleaved ascending sequences, few different
+     values, and a descending array. */
+  return
+    (pattern == 0) ? random_int (1, 1000000) :
+    (pattern == 1) ? (int) ((i % 20) * sz + i / 20) :
+    (pattern == 2) ? random_int (1, 10) :
+    (int) (sz - i);
+}
+
+static void
+test_batch (size_t count, size_t max_sz, size_t num_threads,
+            size_t max_piles, int descending)
+{
+  struct patience_batch_entry *entries =
+    malloc (count * sizeof (struct patience_batch_entry));
+  int **expected = malloc (count * sizeof (int *));
+
+  for (size_t k = 0; k != count; k += 1)
+    {
+      const size_t sz = (size_t) random_int (0, (int) max_sz);
+      const int pattern = random_int (0, 3);
+      int *p = malloc ((sz + 1) * sizeof (int));
+      expected[k] = malloc ((sz + 1) * sizeof (int));
+      for (size_t i = 0; i < sz; i += 1)
+        p[i] = pattern_value (pattern, sz, i);
+      memcpy (expected[k], p, sz * sizeof (int));
+      qsort (expected[k], sz, sizeof (int), intcmp);
+      for (size_t i = 0; descending && i < sz / 2; i += 1)
+        {
+          const int tmp = expected[k][i];
+          expected[k][i] = expected[k][sz - 1 - i];
+          expected[k][sz - 1 - i] = tmp;
+        }
+      entries[k].base = p;
+      entries[k].nmemb = sz;
+      entries[k].size = sizeof (int);
+      entries[k].result = malloc ((sz + 1) * sizeof (int));
+    }
+
+  patience_sort_set_num_threads (num_threads);
+  patience_sort_set_max_piles (max_piles);
+  if (descending)
+    patience_sort_batch_r (entries, count, intcmp_r, &descending);
+  else
+    patience_sort_batch (entries, count, intcmp);
+  patience_sort_set_num_threads (1);
+  patience_sort_set_max_piles (0);
+
+  for (size_t k = 0; k != count; k += 1)
+    {
+      CHECK (memcmp (entries[k].result, expected[k],
+                     entries[k].nmemb * sizeof (int)) == 0);
+      free ((void *) entries[k].base);
+      free (entries[k].result);
+      free (expected[k]);
+    }
+  free (entries);
+  free (expected);
+}
+
+static void
+test_segmented (size_t nsegments, size_t max_sz, size_t first_offset,
+                size_t num_threads, int descending)
+{
+  size_t *offsets = malloc ((nsegments + 1) * sizeof (size_t));
+  offsets[0] = first_offset;
+  for (size_t k = 0; k != nsegments; k += 1)
+    offsets[k + 1] = offsets[k] + (size_t) random_int (0, (int) max_sz);
+  const size_t n = offsets[nsegments] + 1;
+
+  int *p = malloc (n * sizeof (int));
+  int *expected = malloc (n * sizeof (int));
+  int *result = malloc (n * sizeof (int));
+  size_t *indices = malloc (n * sizeof (size_t));
+  for (size_t k = 0; k != nsegments; k += 1)
+    {
+      const size_t sz = offsets[k + 1] - offsets[k];
+      const int pattern = random_int (0, 3);
+      int *seg = expected + offsets[k];
+      for (size_t i = 0; i < sz; i += 1)
+        p[offsets[k] + i] = pattern_value (pattern, sz, i);
+      memcpy (seg, p + offsets[k], sz * sizeof (int));
+      qsort (seg, sz, sizeof (int), intcmp);
+      for (size_t i = 0; descending && i < sz / 2; i += 1)
+        {
+          const int tmp = seg[i];
+          seg[i] = seg[sz - 1 - i];
+          seg[sz - 1 - i] = tmp;
+        }
+    }
+
+  patience_sort_set_num_threads (num_threads);
+  if (descending)
+    {
+      patience_sort_segmented_r (p, sizeof (int), offsets, nsegments,
+                                 intcmp_r, &descending, result);
+      patience_sort_segmented_indices_r (p, sizeof (int), offsets,
+                                         nsegments, intcmp_r,
+                                         &descending, indices);
+    }
+  else
+    {
+      patience_sort_segmented (p, sizeof (int), offsets, nsegments,
+                               intcmp, result);
+      patience_sort_segmented_indices (p, sizeof (int), offsets,
+                                       nsegments, intcmp, indices);
+    }
+  for (size_t k = 0; k != nsegments; k += 1)
+    for (size_t i = offsets[k]; i != offsets[k + 1]; i += 1)
+      {
+        CHECK (result[i] == expected[i]);
+        CHECK (indices[i] < offsets[k + 1] - offsets[k]);
+        CHECK (p[offsets[k] + indices[i]] == expected[i]);
+      }
+
+  if (descending)
+    patience_sort_segmented_in_place_r (p, sizeof (int), offsets,
+                                        nsegments, intcmp_r,
+                                        &descending);
+  else
+    patience_sort_segmented_in_place (p, sizeof (int), offsets,
+                                      nsegments, intcmp);
+  patience_sort_set_num_threads (1);
+  for (size_t i = offsets[0]; i != offsets[nsegments]; i += 1)
+    CHECK (p[i] == expected[i]);
+
+  free (offsets);
+  free (p);
+  free (expected);
+  free (result);
+  free (indices);
+}
+
+static void
+test_parallel (size_t sz, size_t num_threads, int pattern,
+               int descending)
+{
+  int *p = malloc ((sz + 1) * sizeof (int));
+  size_t *indices = malloc ((sz + 1) * sizeof (size_t));
+  int *result = malloc ((sz + 1) * sizeof (int));
+  char *seen = calloc (sz + 1, 1);
+  const int sign = (descending) ? -1 : 1;
+
+  for (size_t i = 0; i < sz; i += 1)
+    p[i] = pattern_value (pattern, sz, i);
+
+  patience_sort_set_num_threads (num_threads);
+  if (descending)
+    {
+      patience_sort_parallel_indices_r (p, sz, sizeof (int), intcmp_r,
+                                        &descending, indices);
+      patience_sort_parallel_r (p, sz, sizeof (int), intcmp_r,
+                                &descending, result);
+    }
+  else
+    {
+      patience_sort_parallel_indices (p, sz, sizeof (int), intcmp,
+                                      indices);
+      patience_sort_parallel (p, sz, sizeof (int), intcmp, result);
+    }
+  patience_sort_set_num_threads (1);
+
+  /* The indices are a permutation, in order, with equal elements in
+     the order they came in. */
+  for (size_t k = 0; k < sz; k += 1)
+    {
+      CHECK (indices[k] < sz && !seen[indices[k]]);
+      seen[indices[k]] = 1;
+      CHECK (result[k] == p[indices[k]]);
+      if (k != 0)
+        {
+          const int cmp = sign * intcmp (&p[indices[k - 1]],
+                                         &p[indices[k]]);
+          CHECK (cmp < 0 || (cmp == 0 && indices[k - 1] < indices[k]));
+        }
+    }
+
+  free (p);
+  free (indices);
+  free (result);
+  free (seen);
+}
+
+struct record
+{
+  int key;
+  int producer;
+  int seq;
+};
+
+static int
+recordcmp_r (const void *px, const void *py, void *arg)
+{
+  return intcmp_r (&((const struct record *) px)->key,
+                   &((const struct record *) py)->key, arg);
+}
+
+struct producer
+{
+  struct patience_sorter *sorter;
+  size_t number;
+  struct record *records;
+  size_t count;
+};
+
+static void *
+produce (void *p)
+{
+  /* Push the records in lots of different sizes. */
+  struct producer *pr = p;
+  size_t i = 0;
+  for (size_t lot = 1; i < pr->count; lot = 2 * lot + 1)
+    {
+      const size_t n = (pr->count - i < lot % 5000) ?
+        pr->count - i : lot % 5000;
+      patience_sorter_push (pr->sorter, pr->number, pr->records + i, n);
+      i += n;
+    }
+  return NULL;
+}
+
+static void
+test_sorter (size_t num_producers, size_t max_sz, size_t idle,
+             int descending)
+{
+  /* Producer idle, if there is one, pushes nothing. */
+  struct patience_sorter *sorter =
+    patience_sorter_new_r (sizeof (struct record), num_producers,
+                           recordcmp_r, &descending);
+  struct producer *producers =
+    malloc (num_producers * sizeof (struct producer));
+  const int sign = (descending) ? -1 : 1;
+
+  /* Fill the sorter twice, draining it in between. */
+  for (int round = 0; round != 2; round += 1)
+    {
+      size_t total = 0;
+      for (size_t p = 0; p != num_producers; p += 1)
+        {
+          const size_t sz =
+            (p == idle) ? 0 : (size_t) random_int (0, (int) max_sz);
+          const int pattern = random_int (0, 3);
+          producers[p].sorter = sorter;
+          producers[p].number = p;
+          producers[p].records = malloc ((sz + 1) * sizeof (struct record));
+          producers[p].count = sz;
+          for (size_t i = 0; i < sz; i += 1)
+            {
+              producers[p].records[i].key = pattern_value (pattern, sz, i);
+              producers[p].records[i].producer = (int) p;
+              producers[p].records[i].seq = (int) i;
+            }
+          total += sz;
+        }
+
+#if HAVE_PTHREAD_CREATE
+      pthread_t *threads = malloc ((num_producers + 1) * sizeof (pthread_t));
+      for (size_t p = 0; p != num_producers; p += 1)
+        CHECK (pthread_create (&threads[p], NULL, produce,
+                               &producers[p]) == 0);
+      for (size_t p = 0; p != num_producers; p += 1)
+        CHECK (pthread_join (threads[p], NULL) == 0);
+      free (threads);
+#else
+      for (size_t p = 0; p != num_producers; p += 1)
+        (void) produce (&producers[p]);
+#endif
+
+      CHECK (patience_sorter_count (sorter) == total);
+      struct record *result = malloc ((total + 1) * sizeof (struct record));
+      patience_sorter_drain (sorter, result);
+      CHECK (patience_sorter_count (sorter) == 0);
+
+      /* In order, with ties by producer and then as pushed. */
+      for (size_t k = 1; k < total; k += 1)
+        {
+          const struct record *x = &result[k - 1];
+          const struct record *y = &result[k];
+          const int cmp = sign * intcmp (&x->key, &y->key);
+          CHECK (cmp < 0
+                 || (cmp == 0
+                     && (x->producer < y->producer
+                         || (x->producer == y->producer
+                             && x->seq < y->seq))));
+        }
+      for (size_t p = 0; p != num_producers; p += 1)
+        free (producers[p].records);
+      free (result);
+    }
+
+  patience_sorter_free (sorter);
+  free (producers);
+}
+
+int
+main (int argc, char *argv[])
+{
+  /* Empty batches, batches of short arrays only, and batches with
+     arrays too long to share the workspace. Enough elements to start
+     other threads, and a cap on the piles that those threads must
+     also keep to. */
+  test_batch (0, 10, 1, 0, 0);
+  test_batch (1000, 0, 1, 0, 0);
+  test_batch (1000, 100, 1, 0, 0);
+  test_batch (1000, 600, 1, 0, 1);
+  test_batch (500, 3000, 1, 0, 0);
+  test_batch (2000, 600, 4, 0, 0);
+  test_batch (2000, 600, 4, 0, 1);
+  test_batch (2000, 600, 4, 5, 0);
+
+  /* Segments of a segmented sort, from empty to too long to share
+     the workspace, not all of them beginning the array. */
+  test_segmented (0, 10, 0, 1, 0);
+  test_segmented (1000, 1, 0, 1, 0);
+  test_segmented (1000, 100, 7, 1, 0);
+  test_segmented (1000, 600, 0, 1, 1);
+  test_segmented (100, 5000, 3, 1, 0);
+  test_segmented (3000, 600, 0, 4, 0);
+  test_segmented (3000, 600, 11, 4, 1);
+  test_segmented (20, 40000, 0, 4, 0);
+
+  /* Parallel sorts too small to be spread over threads, and ones
+     spread over several, with runs of equal elements split between
+     the buckets. */
+  test_parallel (0, 4, 0, 0);
+  test_parallel (1000, 4, 0, 1);
+  test_parallel (200000, 1, 0, 0);
+  for (int pattern = 0; pattern != 4; pattern += 1)
+    {
+      test_parallel (300000, 4, pattern, 0);
+      test_parallel (300000, 3, pattern, 1);
+    }
+
+  /* Sorters with one producer and with several, some of which push
+     nothing, and with more elements than one sort of a slot takes. */
+  test_sorter (1, 100, 1, 0);
+  test_sorter (1, 50000, 1, 1);
+  test_sorter (1, 50000, 0, 0);
+  test_sorter (4, 3, 4, 0);
+  test_sorter (4, 50000, 0, 0);
+  test_sorter (4, 50000, 2, 1);
+  test_sorter (8, 20000, 8, 1);
+  return 0;
+}
@@ -0,0 +1,197 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <patience-sort.h>
+
+/*------------------------------------------------------------------*/
+/* A simple linear congruential generator.                          */
+
+/* The multiplier LCG_A comes from Steele, Guy; Vigna, Sebastiano (28
+   September 2021). "Computationally easy, spectrally good multipliers
+   for congruential pseudorandom number generators".
+   arXiv:2001.05304v3 [cs.DS] */
+#define LCG_A UINT64_C(0xf1357aea2e62a9c5)
+
+/* LCG_C must be odd. */
+#define LCG_C UINT64_C(0xbaceba11beefbead)
+
+uint64_t seed = 0;
+
+static double
+random_double (void)
+{
+  /* IEEE "binary64" or "double" has 52 bits of precision. We will
+     take the high 48 bits of the seed and divide it by 2**48, to get
+     a number 0.0 <= randnum < 1.0 */
+  const double high_48_bits = (double) (seed >> 16);
+  const double divisor = (double) (UINT64_C(1) << 48);
+  const double randnum = high_48_bits / divisor;
+
+  /* The following operation is modulo 2**64, by virtue of standard C
+     behavior for uint64_t. */
+  seed = (LCG_A * seed) + LCG_C;
+
+  return randnum;
+}
+
+static int
+random_int (int m, int n)
+{
+  return m + (int) (random_double () * (n - m + 1));
+}
+
+/*------------------------------------------------------------------*/
+
+#define MAX(x, y) (((x) < (y)) ? (y) : (x))
+
+#define CHECK(expr)                             \
+  if (expr)                                     \
+    {}                                          \
+  else                                          \
+    check_failed (__FILE__, __LINE__)
+
+static void
+check_failed (const char *file, unsigned int line)
+{
+  fprintf (stderr, "CHECK failed at %s:%u\n", file, line);
+  exit (1);
+}
+
+static int
+intcmp (const void *px, const void *py)
+{
+  const int x = *((const int *) px);
+  const int y = *((const int *) py);
+  return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+static int
+intcmp_r (const void *px, const void *py, void *reverse_order)
+{
+  const int x = *((const int *) px);
+  const int y = *((const int *) py);
+  const int cmp = ((x < y) ? -1 : ((x > y) ? 1 : 0));
+  return (*(int *) reverse_order) ? -cmp : cmp;
+}
+
+static void
+test_is_sorted (void)
+{
+  for (size_t sz = 0; sz <= 100000; sz = MAX (1, 10 * sz))
+    {
+      int *p = malloc (sz * sizeof (int));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p[i] = (int) (i / 3);
+      CHECK (patience_is_sorted (p, sz, sizeof (int), intcmp));
+
+      int reverse_order = 1;
+      CHECK (sz <= 3
+             || !patience_is_sorted_r (p, sz, sizeof (int), intcmp_r,
+                                       &reverse_order));
+
+      if (2 <= sz)
+        {
+          p[sz - 1] = -1;
+          CHECK (!patience_is_sorted (p, sz, sizeof (int), intcmp));
+        }
+
+      free (p);
+    }
+}
+
+static void
+test_sorted_and_reversed (void)
+{
+  for (size_t rate = 0; rate <= 10; rate += 1)
+    for (size_t sz = 0; sz <= 100000; sz = MAX (1, 10 * sz))
+      {
+        int *p = malloc (sz * sizeof (int));
+        struct patience_disorder est;
+
+        for (size_t i = 0; i < sz; i += 1)
+          p[i] = (int) i;
+        patience_disorder_estimate (p, sz, sizeof (int), intcmp,
+                                    rate, &est);
+        CHECK (est.sample_size <= sz);
+        CHECK (sz == 0 || est.sample_size != 0);
+        CHECK (est.num_runs <= 1);
+        CHECK (est.num_piles <= 1);
+        CHECK (est.disorder_class == PATIENCE_DISORDER_SORTED);
+
+        int reverse_order = 1;
+        patience_disorder_estimate_r (p, sz, sizeof (int), intcmp_r,
+                                      &reverse_order, rate, &est);
+        CHECK (est.num_runs <= 1);
+        CHECK (est.disorder_class
+               == ((est.sample_size <= 1) ?
+                   PATIENCE_DISORDER_SORTED :
+                   PATIENCE_DISORDER_REVERSED));
+
+        free (p);
+      }
+}
+
+static void
+test_nearly_sorted (void)
+{
+  /* Four interleaved ascending sequences deal into four piles. */
+  const size_t sz = 100000;
+  int *p = malloc (sz * sizeof (int));
+  struct patience_disorder est;
+
+  for (size_t i = 0; i < sz; i += 1)
+    p[i] = (int) ((i % 4) * sz + i / 4);
+  patience_disorder_estimate (p, sz, sizeof (int), intcmp, 1, &est);
+  CHECK (est.sample_size == sz);
+  CHECK (est.num_piles == 4);
+  CHECK (est.disorder_class == PATIENCE_DISORDER_NEARLY_SORTED);
+
+  free (p);
+}
+
+static void
+test_random (void)
+{
+  const size_t sz = 1000000;
+  int *p = malloc (sz * sizeof (int));
+  struct patience_disorder est;
+
+  for (size_t i = 0; i < sz; i += 1)
+    p[i] = random_int (1, 1000000);
+
+  patience_disorder_estimate (p, sz, sizeof (int), intcmp, 100, &est);
+  CHECK (est.sample_size == sz / 100);
+  CHECK (est.num_runs > est.sample_size / 4);
+  CHECK (est.disorder_class == PATIENCE_DISORDER_RANDOM);
+
+  free (p);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_is_sorted ();
+  test_sorted_and_reversed ();
+  test_nearly_sorted ();
+  test_random ();
+  return 0;
+}
@@ -341,6 +341,676 @@ test_random_arrays_indices_r_reverse_order (void)
     }
 }
 
+static int
+pattern_value (int pattern, size_t sz, size_t i)
+{
+  static int x = 0;
+  switch (pattern)
+    {
+    case 0:                     /* Ascending. */
+      x = i;
+      break;
+    case 1:                     /* Descending. */
+      x = -(int) i;
+      break;
+    case 2:                     /* Ascending runs of 1000. */
+      x = i % 1000;
+      break;
+    case 3:                     /* Ascending, with a few strays. */
+      x = (random_int (1, 100) == 1) ? random_int (1, sz) : (int) i;
+      break;
+    case 4:                     /* Two ascending sequences, alternating
+                                   in chunks. */
+      x = ((i / 100) % 2 == 0) ? (int) i : (int) (sz - i);
+      break;
+    case 5:                     /* Descending, with ties. */
+      x = -(int) (i / 10);
+      break;
+    default:                    /* Descending runs of random
+                                   lengths. */
+      x = (random_int (1, 50) == 1) ? random_int (1, 1000) : x - 1;
+      break;
+    }
+  return x;
+}
+
+#define NUM_PATTERNS 7
+
+static void
+test_patterned_arrays (void)
+{
+  for (int pattern = 0; pattern != NUM_PATTERNS; pattern += 1)
+    for (size_t sz = 0; sz <= 1000000; sz = MAX (1, 10 * sz))
+      {
+        int *p1 = malloc (sz * sizeof (int));
+        int *p2 = malloc (sz * sizeof (int));
+        int *p3 = malloc (sz * sizeof (int));
+        size_t *p4 = malloc (sz * sizeof (size_t));
+
+        for (size_t i = 0; i < sz; i += 1)
+          p1[i] = pattern_value (pattern, sz, i);
+
+        for (size_t i = 0; i < sz; i += 1)
+          p2[i] = p1[i];
+        qsort (p2, sz, sizeof (int), intcmp);
+
+        patience_sort (p1, sz, sizeof (int), intcmp, p3);
+        patience_sort_indices (p1, sz, sizeof (int), intcmp, p4);
+
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p3[i]);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p1[p4[i]]);
+        for (size_t i = 1; i < sz; i += 1)
+          CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+        free (p1);
+        free (p2);
+        free (p3);
+        free (p4);
+      }
+}
+
+static void
+test_interleaved_sequences (void)
+{
+  /* k ascending sequences, dealt round robin, make k piles. */
+  for (size_t k = 1; k <= 10; k += 1)
+    for (size_t sz = 0; sz <= 100000; sz = MAX (1, 10 * sz))
+      {
+        int *p1 = malloc (sz * sizeof (int));
+        int *p2 = malloc (sz * sizeof (int));
+        int *p3 = malloc (sz * sizeof (int));
+        size_t *p4 = malloc (sz * sizeof (size_t));
+
+        for (size_t i = 0; i < sz; i += 1)
+          p1[i] = (i % k) * (sz / 2) + i / k;
+
+        for (size_t i = 0; i < sz; i += 1)
+          p2[i] = p1[i];
+        qsort (p2, sz, sizeof (int), intcmp);
+
+        patience_sort (p1, sz, sizeof (int), intcmp, p3);
+        patience_sort_indices (p1, sz, sizeof (int), intcmp, p4);
+
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p3[i]);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p1[p4[i]]);
+        for (size_t i = 1; i < sz; i += 1)
+          CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+        free (p1);
+        free (p2);
+        free (p3);
+        free (p4);
+      }
+}
+
+
+static uint64_t
+intkey (const void *px)
+{
+  /* Order-preserving: flip the sign bit. */
+  return (uint64_t) (uint32_t) *((const int *) px) ^ UINT64_C (0x80000000);
+}
+
+static uint64_t
+coarse_intkey (const void *px)
+{
+  /* Only a prefix of the ordering, so that keys tie often. */
+  return intkey (px) >> 8;
+}
+
+static uint64_t
+intkey_r (const void *px, void *reverse_order)
+{
+  const uint64_t k = intkey (px);
+  return (*(int *) reverse_order) ? ~k : k;
+}
+
+static void
+test_keyed_sorts (void)
+{
+  uint64_t (*keys[2]) (const void *) = { intkey, coarse_intkey };
+  for (size_t ikey = 0; ikey != 2; ikey += 1)
+    for (size_t sz = 0; sz <= 1000000; sz = MAX (1, 10 * sz))
+      {
+        int *p1 = malloc (sz * sizeof (int));
+        int *p2 = malloc (sz * sizeof (int));
+        int *p3 = malloc (sz * sizeof (int));
+        size_t *p4 = malloc (sz * sizeof (size_t));
+
+        for (size_t i = 0; i < sz; i += 1)
+          p1[i] = random_int (-1000, 1000);
+
+        for (size_t i = 0; i < sz; i += 1)
+          p2[i] = p1[i];
+        qsort (p2, sz, sizeof (int), intcmp);
+
+        patience_sort_keyed (p1, sz, sizeof (int), intcmp, keys[ikey], p3);
+        patience_sort_indices_keyed (p1, sz, sizeof (int), intcmp,
+                                     keys[ikey], p4);
+
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p3[i]);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p1[p4[i]]);
+        for (size_t i = 1; i < sz; i += 1)
+          CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+        patience_sort_in_place_keyed (p1, sz, sizeof (int), intcmp,
+                                      keys[ikey]);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p1[i]);
+
+        free (p1);
+        free (p2);
+        free (p3);
+        free (p4);
+      }
+}
+
+static void
+test_keyed_sorts_r_reverse_order (void)
+{
+  for (size_t sz = 0; sz <= 1000000; sz = MAX (1, 10 * sz))
+    {
+      int *p1 = malloc (sz * sizeof (int));
+      int *p2 = malloc (sz * sizeof (int));
+      int *p3 = malloc (sz * sizeof (int));
+      size_t *p4 = malloc (sz * sizeof (size_t));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = random_int (-1000, 1000);
+
+      for (size_t i = 0; i < sz; i += 1)
+        p2[i] = p1[i];
+      qsort (p2, sz, sizeof (int), intcmp);
+
+      int reverse_order = 1;
+
+      patience_sort_keyed_r (p1, sz, sizeof (int), intcmp_r, intkey_r,
+                             &reverse_order, p3);
+      patience_sort_indices_keyed_r (p1, sz, sizeof (int), intcmp_r,
+                                     intkey_r, &reverse_order, p4);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[sz - 1 - i] == p3[i]);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[sz - 1 - i] == p1[p4[i]]);
+      for (size_t i = 1; i < sz; i += 1)
+        CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+      patience_sort_in_place_keyed_r (p1, sz, sizeof (int), intcmp_r,
+                                      intkey_r, &reverse_order);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[sz - 1 - i] == p1[i]);
+
+      free (p1);
+      free (p2);
+      free (p3);
+      free (p4);
+    }
+}
+
+
+static void
+test_capped_piles (void)
+{
+  const size_t caps[3] = { 2, 16, 256 };
+  for (size_t icap = 0; icap != 3; icap += 1)
+    for (int pattern = 0; pattern != NUM_PATTERNS; pattern += 1)
+      for (size_t sz = 0; sz <= 100000; sz = MAX (1, 10 * sz))
+        {
+          int *p1 = malloc (sz * sizeof (int));
+          int *p2 = malloc (sz * sizeof (int));
+          int *p3 = malloc (sz * sizeof (int));
+          size_t *p4 = malloc (sz * sizeof (size_t));
+
+          for (size_t i = 0; i < sz; i += 1)
+            p1[i] = pattern_value (pattern, sz, i);
+
+          for (size_t i = 0; i < sz; i += 1)
+            p2[i] = p1[i];
+          qsort (p2, sz, sizeof (int), intcmp);
+
+          patience_sort_set_max_piles (caps[icap]);
+          patience_sort (p1, sz, sizeof (int), intcmp, p3);
+          patience_sort_indices_keyed (p1, sz, sizeof (int), intcmp,
+                                       coarse_intkey, p4);
+          patience_sort_set_max_piles (0);
+
+          for (size_t i = 0; i < sz; i += 1)
+            CHECK (p2[i] == p3[i]);
+          for (size_t i = 0; i < sz; i += 1)
+            CHECK (p2[i] == p1[p4[i]]);
+          for (size_t i = 1; i < sz; i += 1)
+            CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+          free (p1);
+          free (p2);
+          free (p3);
+          free (p4);
+        }
+}
+
+
+static void
+test_many_interleaved_sequences (void)
+{
+  /* Enough piles for the tournament trees, but too few for the deal
+     to give up on them: the plain tree, the keyed tree, and the tree
+     laid out in blocks. */
+  const size_t ks[2] = { 20, 1100 };
+  const size_t sz = 2000000;
+  for (size_t ik = 0; ik != 2; ik += 1)
+    {
+      const size_t k = ks[ik];
+
+      int *p1 = malloc (sz * sizeof (int));
+      int *p2 = malloc (sz * sizeof (int));
+      int *p3 = malloc (sz * sizeof (int));
+      size_t *p4 = malloc (sz * sizeof (size_t));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = (i % k) * (sz / (2 * k)) + i / k;
+
+      for (size_t i = 0; i < sz; i += 1)
+        p2[i] = p1[i];
+      qsort (p2, sz, sizeof (int), intcmp);
+
+      patience_sort (p1, sz, sizeof (int), intcmp, p3);
+      patience_sort_indices_keyed (p1, sz, sizeof (int), intcmp,
+                                   coarse_intkey, p4);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p3[i]);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p1[p4[i]]);
+      for (size_t i = 1; i < sz; i += 1)
+        CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+      free (p1);
+      free (p2);
+      free (p3);
+      free (p4);
+    }
+}
+
+
+static size_t counted_intcmp_calls = 0;
+
+static int
+counted_intcmp (const void *px, const void *py)
+{
+  counted_intcmp_calls += 1;
+  return intcmp (px, py);
+}
+
+static void
+test_keyed_disorderly_data (void)
+{
+  /* Random data makes the deal give up and merge sort instead. The
+     merge sort, too, must go by the keys, calling compar only where
+     keys tie. */
+  uint64_t (*keys[2]) (const void *) = { intkey, coarse_intkey };
+  const size_t sz = 1000000;
+  for (size_t ikey = 0; ikey != 2; ikey += 1)
+    {
+      int *p1 = malloc (sz * sizeof (int));
+      int *p2 = malloc (sz * sizeof (int));
+      int *p3 = malloc (sz * sizeof (int));
+      size_t *p4 = malloc (sz * sizeof (size_t));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = random_int (-1000000000, 1000000000);
+
+      for (size_t i = 0; i < sz; i += 1)
+        p2[i] = p1[i];
+      qsort (p2, sz, sizeof (int), intcmp);
+
+      counted_intcmp_calls = 0;
+      patience_sort_keyed (p1, sz, sizeof (int), counted_intcmp,
+                           keys[ikey], p3);
+      if (keys[ikey] == intkey)
+        CHECK (counted_intcmp_calls < sz / 10);
+      patience_sort_indices_keyed (p1, sz, sizeof (int), intcmp,
+                                   keys[ikey], p4);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p3[i]);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p1[p4[i]]);
+      for (size_t i = 1; i < sz; i += 1)
+        CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+      patience_sort_in_place_keyed (p1, sz, sizeof (int), intcmp,
+                                    keys[ikey]);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p1[i]);
+
+      free (p1);
+      free (p2);
+      free (p3);
+      free (p4);
+    }
+}
+
+
+/* An allocator that keeps track of the most it has had out at
+   once. */
+struct peak
+{
+  size_t live_bytes;
+  size_t peak_bytes;
+};
+
+static void *
+peak_alloc (size_t size, void *ctx)
+{
+  struct peak *p = ctx;
+  void *ptr = malloc (size);
+  if (ptr != NULL)
+    {
+      p->live_bytes += size;
+      p->peak_bytes = MAX (p->peak_bytes, p->live_bytes);
+    }
+  return ptr;
+}
+
+static void
+peak_free (void *ptr, size_t size, void *ctx)
+{
+  struct peak *p = ctx;
+  p->live_bytes -= size;
+  free (ptr);
+}
+
+/* Elements so large that copies of them in a workspace would cost far
+   more than the indices do. */
+struct big_element
+{
+  int value;
+  size_t serial;
+  char padding[1008];
+};
+
+static int
+big_element_cmp (const void *px, const void *py)
+{
+  return intcmp (&((const struct big_element *) px)->value,
+                 &((const struct big_element *) py)->value);
+}
+
+static uint64_t
+big_element_key (const void *px)
+{
+  return intkey (&((const struct big_element *) px)->value);
+}
+
+static uint64_t
+coarse_big_element_key (const void *px)
+{
+  return coarse_intkey (&((const struct big_element *) px)->value);
+}
+
+static void
+check_big_elements (size_t sz, const struct big_element *p)
+{
+  for (size_t i = 1; i < sz; i += 1)
+    {
+      CHECK (p[i - 1].value <= p[i].value);
+      CHECK (p[i - 1].value != p[i].value
+             || p[i - 1].serial < p[i].serial);
+    }
+  for (size_t i = 0; i < sz; i += 1)
+    CHECK (p[i].padding[1007] == (char) (p[i].serial & 0xFF));
+}
+
+static void
+test_large_elements (void)
+{
+  /* Random data, which a sort of small elements gives up dealing,
+     without keys, with keys, and with keys that tie often. Whatever
+     the sort does, its workspace must go by the number of elements,
+     not by their size. */
+  uint64_t (*keys[3]) (const void *) =
+    { NULL, big_element_key, coarse_big_element_key };
+  const size_t sz = 20000;
+  const size_t most_bytes = 8 * sz * sizeof (size_t);
+  for (size_t ikey = 0; ikey != 3; ikey += 1)
+    {
+      struct big_element *p1 = malloc (sz * sizeof (struct big_element));
+      struct big_element *p2 = malloc (sz * sizeof (struct big_element));
+      size_t *p3 = malloc (sz * sizeof (size_t));
+
+      for (size_t i = 0; i < sz; i += 1)
+        {
+          p1[i].value = random_int (-100000, 100000);
+          p1[i].serial = i;
+          p1[i].padding[1007] = (char) (i & 0xFF);
+        }
+
+      struct peak a = { 0, 0 };
+      patience_sort_set_allocator (peak_alloc, peak_free, &a);
+
+      if (keys[ikey] == NULL)
+        patience_sort_indices (p1, sz, sizeof (struct big_element),
+                               big_element_cmp, p3);
+      else
+        patience_sort_indices_keyed (p1, sz, sizeof (struct big_element),
+                                     big_element_cmp, keys[ikey], p3);
+      CHECK (a.live_bytes == 0);
+      CHECK (a.peak_bytes <= most_bytes);
+      for (size_t i = 1; i < sz; i += 1)
+        {
+          CHECK (p1[p3[i - 1]].value <= p1[p3[i]].value);
+          CHECK (p1[p3[i - 1]].value != p1[p3[i]].value
+                 || p3[i - 1] < p3[i]);
+        }
+
+      a.peak_bytes = 0;
+      if (keys[ikey] == NULL)
+        patience_sort (p1, sz, sizeof (struct big_element),
+                       big_element_cmp, p2);
+      else
+        patience_sort_keyed (p1, sz, sizeof (struct big_element),
+                             big_element_cmp, keys[ikey], p2);
+      CHECK (a.live_bytes == 0);
+      CHECK (a.peak_bytes <= most_bytes);
+      check_big_elements (sz, p2);
+
+      patience_sort_set_allocator (NULL, NULL, NULL);
+
+      if (keys[ikey] == NULL)
+        patience_sort_in_place (p1, sz, sizeof (struct big_element),
+                                big_element_cmp);
+      else
+        patience_sort_in_place_keyed (p1, sz,
+                                      sizeof (struct big_element),
+                                      big_element_cmp, keys[ikey]);
+      check_big_elements (sz, p1);
+
+      free (p1);
+      free (p2);
+      free (p3);
+    }
+}
+
+
+static void
+test_few_distinct_values (void)
+{
+  /* Around the most values that are grouped rather than dealt. */
+  const int ds[5] = { 1, 2, 1000, 1024, 1025 };
+  const size_t sz = 100000;
+  for (size_t id = 0; id != 5; id += 1)
+    {
+      int *p1 = malloc (sz * sizeof (int));
+      int *p2 = malloc (sz * sizeof (int));
+      int *p3 = malloc (sz * sizeof (int));
+      size_t *p4 = malloc (sz * sizeof (size_t));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = ((i < (size_t) ds[id]) ?
+                 (int) i : random_int (0, ds[id] - 1));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p2[i] = p1[i];
+      qsort (p2, sz, sizeof (int), intcmp);
+
+      patience_sort (p1, sz, sizeof (int), intcmp, p3);
+      patience_sort_indices (p1, sz, sizeof (int), intcmp, p4);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p3[i]);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p1[p4[i]]);
+      for (size_t i = 1; i < sz; i += 1)
+        CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+      free (p1);
+      free (p2);
+      free (p3);
+      free (p4);
+    }
+}
+
+
+static void
+test_deal_and_merge (void)
+{
+  for (size_t sz = 0; sz <= 1000000; sz = MAX (1, 10 * sz))
+    {
+      int *p1 = malloc (sz * sizeof (int));
+      int *p2 = malloc (sz * sizeof (int));
+      int *p3 = malloc (sz * sizeof (int));
+      size_t *p4 = malloc (sz * sizeof (size_t));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = random_int (1, 1000);
+
+      for (size_t i = 0; i < sz; i += 1)
+        p2[i] = p1[i];
+      qsort (p2, sz, sizeof (int), intcmp);
+
+      struct patience_piles *piles;
+      patience_deal (p1, sz, sizeof (int), intcmp, &piles);
+
+      const size_t num_piles = patience_piles_count (piles);
+      CHECK ((sz == 0) == (num_piles == 0));
+      size_t *lengths = malloc (num_piles * sizeof (size_t));
+      patience_piles_lengths (piles, lengths);
+      size_t total = 0;
+      for (size_t i = 0; i < num_piles; i += 1)
+        {
+          CHECK (lengths[i] != 0);
+          total += lengths[i];
+        }
+      CHECK (total == sz);
+      free (lengths);
+
+      /* Both results at once. */
+      patience_merge_piles (piles, p4, p3);
+      patience_piles_free (piles);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p3[i]);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p1[p4[i]]);
+      for (size_t i = 1; i < sz; i += 1)
+        CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+      int reverse_order = 1;
+      patience_deal_r (p1, sz, sizeof (int), intcmp_r, &reverse_order,
+                       &piles);
+      patience_merge_piles (piles, NULL, p3);
+      patience_piles_free (piles);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[sz - 1 - i] == p3[i]);
+
+      free (p1);
+      free (p2);
+      free (p3);
+      free (p4);
+    }
+}
+
+
+static void
+test_huffman_planner (void)
+{
+  for (int pattern = 0; pattern != NUM_PATTERNS; pattern += 1)
+    for (size_t sz = 0; sz <= 1000000; sz = MAX (1, 10 * sz))
+      {
+        int *p1 = malloc (sz * sizeof (int));
+        int *p2 = malloc (sz * sizeof (int));
+        int *p3 = malloc (sz * sizeof (int));
+        size_t *p4 = malloc (sz * sizeof (size_t));
+
+        for (size_t i = 0; i < sz; i += 1)
+          p1[i] = pattern_value (pattern, sz, i);
+
+        for (size_t i = 0; i < sz; i += 1)
+          p2[i] = p1[i];
+        qsort (p2, sz, sizeof (int), intcmp);
+
+        patience_sort_set_merge_planner (PATIENCE_MERGE_HUFFMAN);
+        patience_sort (p1, sz, sizeof (int), intcmp, p3);
+        patience_sort_indices (p1, sz, sizeof (int), intcmp, p4);
+        patience_sort_set_merge_planner (PATIENCE_MERGE_TOURNAMENT);
+
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p3[i]);
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p1[p4[i]]);
+        for (size_t i = 1; i < sz; i += 1)
+          CHECK (p3[i - 1] != p3[i] || p4[i - 1] < p4[i]);
+
+        free (p1);
+        free (p2);
+        free (p3);
+        free (p4);
+      }
+}
+
+static void
+test_prefaulted_workspaces (void)
+{
+  /* Big enough for the workspaces to be mapped, rather than taken
+     from malloc. */
+  for (int pattern = 0; pattern != NUM_PATTERNS; pattern += 1)
+    {
+      const size_t sz = 2000000;
+      int *p1 = malloc (sz * sizeof (int));
+      int *p2 = malloc (sz * sizeof (int));
+      int *p3 = malloc (sz * sizeof (int));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = pattern_value (pattern, sz, i);
+
+      for (size_t i = 0; i < sz; i += 1)
+        p2[i] = p1[i];
+      qsort (p2, sz, sizeof (int), intcmp);
+
+      patience_sort_set_prefault (1);
+      patience_sort (p1, sz, sizeof (int), intcmp, p3);
+      patience_sort_in_place (p1, sz, sizeof (int), intcmp);
+      patience_sort_set_prefault (0);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p3[i]);
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p1[i]);
+
+      free (p1);
+      free (p2);
+      free (p3);
+    }
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -353,5 +1023,17 @@ main (int argc, char *argv[])
   test_random_arrays_in_place_r_reverse_order ();
   test_random_arrays_indices_r ();
   test_random_arrays_indices_r_reverse_order ();
+  test_patterned_arrays ();
+  test_interleaved_sequences ();
+  test_keyed_sorts ();
+  test_keyed_sorts_r_reverse_order ();
+  test_capped_piles ();
+  test_many_interleaved_sequences ();
+  test_keyed_disorderly_data ();
+  test_large_elements ();
+  test_few_distinct_values ();
+  test_deal_and_merge ();
+  test_huffman_planner ();
+  test_prefaulted_workspaces ();
   return 0;
 }
@@ -0,0 +1,236 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <patience-sort.h>
+
+/*------------------------------------------------------------------*/
+/* A simple linear congruential generator.                          */
+
+/* The multiplier LCG_A comes from Steele, Guy; Vigna, Sebastiano (28
+   September 2021). "Computationally easy, spectrally good multipliers
+   for congruential pseudorandom number generators".
+   arXiv:2001.05304v3 [cs.DS] */
+#define LCG_A UINT64_C(0xf1357aea2e62a9c5)
+
+/* LCG_C must be odd. */
+#define LCG_C UINT64_C(0xbaceba11beefbead)
+
+uint64_t seed = 0;
+
+static double
+random_double (void)
+{
+  /* IEEE "binary64" or "double" has 52 bits of precision. We will
+     take the high 48 bits of the seed and divide it by 2**48, to get
+     a number 0.0 <= randnum < 1.0 */
+  const double high_48_bits = (double) (seed >> 16);
+  const double divisor = (double) (UINT64_C(1) << 48);
+  const double randnum = high_48_bits / divisor;
+
+  /* The following operation is modulo 2**64, by virtue of standard C
+     behavior for uint64_t. */
+  seed = (LCG_A * seed) + LCG_C;
+
+  return randnum;
+}
+
+static int
+random_int (int m, int n)
+{
+  return m + (int) (random_double () * (n - m + 1));
+}
+
+/*------------------------------------------------------------------*/
+
+#define CHECK(expr)                             \
+  if (expr)                                     \
+    {}                                          \
+  else                                          \
+    check_failed (__FILE__, __LINE__)
+
+static void
+check_failed (const char *file, unsigned int line)
+{
+  fprintf (stderr, "CHECK failed at %s:%u\n", file, line);
+  exit (1);
+}
+
+static int
+intcmp (const void *px, const void *py)
+{
+  const int x = *((const int *) px);
+  const int y = *((const int *) py);
+  return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+static int
+intcmp_r (const void *px, const void *py, void *arg)
+{
+  /* Compare in descending order if *arg is nonzero. */
+  const int sign = (*((const int *) arg) != 0) ? -1 : 1;
+  return sign * intcmp (px, py);
+}
+
+/*------------------------------------------------------------------*/
+
+static int
+pattern_value (int pattern, size_t sz, size_t i)
+{
+  /* Random values, interleaved ascending sequences, few different
+     values, and a descending array. */
+  return
+    (pattern == 0) ? random_int (1, 1000000) :
+    (pattern == 1) ? (int) ((i % 20) * sz + i / 20) :
+    (pattern == 2) ? random_int (1, 10) :
+    (int) (sz - i);
+}
+
+static void
+test_job (size_t sz, int pattern, size_t max_elements, int descending)
+{
+  int *p = malloc ((sz + 1) * sizeof (int));
+  size_t *expected = malloc ((sz + 1) * sizeof (size_t));
+  size_t *indices = malloc ((sz + 1) * sizeof (size_t));
+  int *result = malloc ((sz + 1) * sizeof (int));
+
+  for (size_t i = 0; i < sz; i += 1)
+    p[i] = pattern_value (pattern, sz, i);
+  patience_sort_indices_r (p, sz, sizeof (int), intcmp_r, &descending,
+                           expected);
+
+  struct patience_job *job =
+    (descending) ?
+    patience_job_new_r (p, sz, sizeof (int), intcmp_r, &descending,
+                        indices, result) :
+    patience_job_new (p, sz, sizeof (int), intcmp, indices, result);
+
+  /* Each step gets somewhere, until the job is done. */
+  size_t progress = patience_job_progress (job);
+  CHECK (progress == 0);
+  while (!patience_job_step (job, max_elements))
+    {
+      CHECK (progress < patience_job_progress (job));
+      progress = patience_job_progress (job);
+    }
+  CHECK (patience_job_progress (job) == 2 * sz);
+  CHECK (patience_job_step (job, max_elements));
+  patience_job_free (job);
+
+  /* The same stable order as an ordinary sort. */
+  for (size_t k = 0; k < sz; k += 1)
+    {
+      CHECK (indices[k] == expected[k]);
+      CHECK (result[k] == p[expected[k]]);
+    }
+
+  free (p);
+  free (expected);
+  free (indices);
+  free (result);
+}
+
+static void
+test_cancel (size_t sz, size_t num_steps)
+{
+  int *p = malloc ((sz + 1) * sizeof (int));
+  int *result = malloc ((sz + 1) * sizeof (int));
+  for (size_t i = 0; i < sz; i += 1)
+    p[i] = random_int (1, 1000000);
+
+  struct patience_job *job =
+    patience_job_new (p, sz, sizeof (int), intcmp, NULL, result);
+  for (size_t i = 0; i != num_steps; i += 1)
+    (void) patience_job_step (job, 1000);
+  patience_job_free (job);
+
+  free (p);
+  free (result);
+}
+
+static size_t num_allocations = 0;
+
+static void *
+counting_alloc (size_t size, void *ctx)
+{
+  num_allocations += 1;
+  return malloc (size);
+}
+
+static void
+counting_free (void *ptr, size_t size, void *ctx)
+{
+  free (ptr);
+}
+
+static void
+test_no_allocation_in_steps (size_t sz, size_t max_elements)
+{
+  /* Everything is allocated when the job is made. */
+  int *p = malloc ((sz + 1) * sizeof (int));
+  size_t *indices = malloc ((sz + 1) * sizeof (size_t));
+  int *result = malloc ((sz + 1) * sizeof (int));
+  for (size_t i = 0; i < sz; i += 1)
+    p[i] = random_int (1, 1000000);
+
+  patience_sort_set_allocator (counting_alloc, counting_free, NULL);
+  struct patience_job *job =
+    patience_job_new (p, sz, sizeof (int), intcmp, indices, result);
+  const size_t made = num_allocations;
+  while (!patience_job_step (job, max_elements))
+    CHECK (num_allocations == made);
+  CHECK (num_allocations == made);
+  patience_job_free (job);
+  patience_sort_set_allocator (NULL, NULL, NULL);
+
+  for (size_t k = 1; k < sz; k += 1)
+    CHECK (result[k - 1] <= result[k]);
+
+  free (p);
+  free (indices);
+  free (result);
+}
+
+int
+main (int argc, char *argv[])
+{
+  /* Sizes from empty to many runs, slices from one element to the
+     whole array. */
+  const size_t sizes[] = { 0, 1, 100, 4096, 4097, 30000, 300000 };
+  const size_t slices[] = { 1, 1000, 100000, SIZE_MAX };
+  for (size_t i = 0; i != sizeof sizes / sizeof sizes[0]; i += 1)
+    for (size_t j = 0; j != sizeof slices / sizeof slices[0]; j += 1)
+      if (sizes[i] < 100000 || slices[j] != 1)
+        for (int pattern = 0; pattern != 4; pattern += 1)
+          test_job (sizes[i], pattern, slices[j], pattern % 2);
+
+  /* Jobs freed before they are done, in each phase. */
+  test_cancel (100000, 0);
+  test_cancel (100000, 3);
+  test_cancel (100000, 25);
+  test_cancel (100000, 30);
+
+  /* Steps allocate nothing. */
+  test_no_allocation_in_steps (100, 10);
+  test_no_allocation_in_steps (100000, 1000);
+  return 0;
+}
@@ -0,0 +1,261 @@
+/*
+  Copyright © 2022 Barry Schwartz
+
+  This program is free software: you can redistribute it and/or
+  modify it under the terms of the GNU General Public License, as
+  published by the Free Software Foundation, either version 3 of the
+  License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received copies of the GNU General Public License
+  along with this program. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <patience-sort.h>
+
+/*------------------------------------------------------------------*/
+/* A simple linear congruential generator.                          */
+
+/* The multiplier LCG_A comes from Steele, Guy; Vigna, Sebastiano (28
+   September 2021). "Computationally easy, spectrally good multipliers
+   for congruential pseudorandom number generators".
+   arXiv:2001.05304v3 [cs.DS] */
+#define LCG_A UINT64_C(0xf1357aea2e62a9c5)
+
+/* LCG_C must be odd. */
+#define LCG_C UINT64_C(0xbaceba11beefbead)
+
+uint64_t seed = 0;
+
+static double
+random_double (void)
+{
+  /* IEEE "binary64" or "double" has 52 bits of precision. We will
+     take the high 48 bits of the seed and divide it by 2**48, to get
+     a number 0.0 <= randnum < 1.0 */
+  const double high_48_bits = (double) (seed >> 16);
+  const double divisor = (double) (UINT64_C(1) << 48);
+  const double randnum = high_48_bits / divisor;
+
+  /* The following operation is modulo 2**64, by virtue of standard C
+     behavior for uint64_t. */
+  seed = (LCG_A * seed) + LCG_C;
+
+  return randnum;
+}
+
+static int
+random_int (int m, int n)
+{
+  return m + (int) (random_double () * (n - m + 1));
+}
+
+/*------------------------------------------------------------------*/
+
+#define MAX(x, y) (((x) < (y)) ? (y) : (x))
+
+#define CHECK(expr)                             \
+  if (expr)                                     \
+    {}                                          \
+  else                                          \
+    check_failed (__FILE__, __LINE__)
+
+static void
+check_failed (const char *file, unsigned int line)
+{
+  fprintf (stderr, "CHECK failed at %s:%u\n", file, line);
+  exit (1);
+}
+
+static int
+intcmp (const void *px, const void *py)
+{
+  const int x = *((const int *) px);
+  const int y = *((const int *) py);
+  return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+static int
+intcmp_r (const void *px, const void *py, void *reverse_order)
+{
+  const int x = *((const int *) px);
+  const int y = *((const int *) py);
+  const int cmp = ((x < y) ? -1 : ((x > y) ? 1 : 0));
+  return (*(int *) reverse_order) ? -cmp : cmp;
+}
+
+static void
+check_consistent (const struct patience_sort_stats *stats, size_t sz)
+{
+  CHECK (stats->num_distinct != 0
+         || (stats->num_conses + stats->num_appends
+             + stats->num_new_piles + stats->num_undealt == sz));
+  CHECK (stats->num_distinct <= sz);
+  CHECK (stats->num_new_piles == stats->num_piles);
+  CHECK (stats->tournament_size == 0
+         || stats->num_piles <= stats->tournament_size);
+  CHECK (sz <= 128 || stats->bytes_allocated != 0);
+  if (sz <= 1)
+    CHECK (stats->deal_comparisons + stats->merge_comparisons == 0);
+}
+
+static void
+test_random_arrays (void)
+{
+  for (size_t sz = 0; sz <= 1000000; sz = MAX (1, 10 * sz))
+    {
+      int *p1 = malloc (sz * sizeof (int));
+      int *p2 = malloc (sz * sizeof (int));
+      int *p3 = malloc (sz * sizeof (int));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = random_int (1, 1000);
+
+      for (size_t i = 0; i < sz; i += 1)
+        p2[i] = p1[i];
+      qsort (p2, sz, sizeof (int), intcmp);
+
+      struct patience_sort_stats stats;
+      patience_sort_ex (p1, sz, sizeof (int), intcmp, p3, &stats);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == p3[i]);
+      check_consistent (&stats, sz);
+
+      /* Random data this large, with only 1000 values, is grouped by
+         value. */
+      CHECK (sz < 10000 || stats.num_distinct == 1000);
+
+      free (p1);
+      free (p2);
+      free (p3);
+    }
+}
+
+static void
+test_ascending_arrays (void)
+{
+  for (size_t sz = 1; sz <= 1000000; sz = 10 * sz)
+    {
+      int *p1 = malloc (sz * sizeof (int));
+      size_t *p2 = malloc (sz * sizeof (size_t));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = i;
+
+      struct patience_sort_stats stats;
+      patience_sort_indices_ex (p1, sz, sizeof (int), intcmp, p2,
+                                &stats);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p2[i] == i);
+      check_consistent (&stats, sz);
+      CHECK (stats.num_piles == 1);
+      CHECK (stats.num_appends == 0);
+
+      free (p1);
+      free (p2);
+    }
+}
+
+static void
+test_ascending_arrays_with_ties (void)
+{
+  /* Data in order, even with values repeated, is dealt rather than
+     grouped, and the look for few values costs no more than a
+     sixteenth of a comparison per element. */
+  const size_t sizes[3] = { 8192, 100000, 1000000 };
+  for (size_t k = 0; k != 3; k += 1)
+    for (size_t repeats = 1; repeats <= 100; repeats *= 10)
+      {
+        const size_t sz = sizes[k];
+        int *p1 = malloc (sz * sizeof (int));
+        int *p2 = malloc (sz * sizeof (int));
+
+        for (size_t i = 0; i < sz; i += 1)
+          p1[i] = i / repeats;
+
+        struct patience_sort_stats stats;
+        patience_sort_ex (p1, sz, sizeof (int), intcmp, p2, &stats);
+
+        for (size_t i = 0; i < sz; i += 1)
+          CHECK (p2[i] == p1[i]);
+        check_consistent (&stats, sz);
+        CHECK (stats.num_distinct == 0);
+        CHECK (stats.num_piles == 1);
+        CHECK (stats.deal_comparisons + stats.merge_comparisons
+               <= sz + sz / 16);
+
+        free (p1);
+        free (p2);
+      }
+}
+
+static void
+test_descending_arrays_in_place_r (void)
+{
+  for (size_t sz = 1; sz <= 1000000; sz = 10 * sz)
+    {
+      int *p1 = malloc (sz * sizeof (int));
+
+      for (size_t i = 0; i < sz; i += 1)
+        p1[i] = i;
+
+      int reverse_order = 1;
+      struct patience_sort_stats stats;
+      patience_sort_in_place_ex_r (p1, sz, sizeof (int), intcmp_r,
+                                   &reverse_order, &stats);
+
+      for (size_t i = 0; i < sz; i += 1)
+        CHECK (p1[i] == sz - 1 - i);
+      check_consistent (&stats, sz);
+      CHECK (stats.num_piles == 1);
+      CHECK (stats.num_conses == 0);
+
+      free (p1);
+    }
+}
+
+static void
+test_null_stats (void)
+{
+  int p1[1000];
+  int p2[1000];
+  size_t p3[1000];
+
+  for (size_t i = 0; i < 1000; i += 1)
+    p1[i] = random_int (1, 1000);
+
+  int reverse_order = 0;
+  patience_sort_ex_r (p1, 1000, sizeof (int), intcmp_r,
+                      &reverse_order, p2, NULL);
+  patience_sort_indices_ex_r (p1, 1000, sizeof (int), intcmp_r,
+                              &reverse_order, p3, NULL);
+  for (size_t i = 0; i < 1000; i += 1)
+    CHECK (p2[i] == p1[p3[i]]);
+  for (size_t i = 1; i < 1000; i += 1)
+    CHECK (p2[i - 1] <= p2[i]);
+
+  patience_sort_in_place_ex (p1, 1000, sizeof (int), intcmp, NULL);
+  for (size_t i = 0; i < 1000; i += 1)
+    CHECK (p1[i] == p2[i]);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_random_arrays ();
+  test_ascending_arrays ();
+  test_ascending_arrays_with_ties ();
+  test_descending_arrays_in_place_r ();
+  test_null_stats ();
+  return 0;
+}
@@ -269,6 +269,151 @@ test_stable_sort (void)
     CHECK (strcmp (sorted_words[i], words[i]) == 0);
 }
 
+/* Records large enough that sorting enough of them makes an output
+   that is streamed. */
+struct record
+{
+  int key;
+  size_t serial;
+  char padding[496];
+};
+
+static int
+record_cmp (const void *px, const void *py)
+{
+  const int x = ((const struct record *) px)->key;
+  const int y = ((const struct record *) py)->key;
+  return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+static void
+check_records (size_t n, const struct record *records)
+{
+  for (size_t i = 1; i < n; i += 1)
+    {
+      CHECK (records[i - 1].key <= records[i].key);
+      if (records[i - 1].key == records[i].key)
+        CHECK (records[i - 1].serial < records[i].serial);
+    }
+}
+
+static void
+test_large_output (void)
+{
+  /* Interleave a few ascending sequences, with values in common, so
+     that the sort deals a few piles and merges them. */
+  const size_t n = 80000;
+  const int k = 20;
+  int next[20] = { 0 };
+  struct record *records = malloc (n * sizeof (struct record));
+  struct record *sorted = malloc (n * sizeof (struct record));
+  for (size_t i = 0; i != n; i += 1)
+    {
+      const int j = random_int (0, k - 1);
+      records[i].key = next[j];
+      records[i].serial = i;
+      memset (records[i].padding, (int) (i & 0xFF),
+              sizeof records[i].padding);
+      next[j] += random_int (0, 3);
+    }
+
+  patience_sort (records, n, sizeof (struct record), record_cmp,
+                 sorted);
+  check_records (n, sorted);
+  for (size_t i = 0; i != n; i += 1)
+    CHECK (sorted[i].padding[495] == (char) (sorted[i].serial & 0xFF));
+
+  patience_sort_in_place (records, n, sizeof (struct record),
+                          record_cmp);
+  CHECK (memcmp (records, sorted, n * sizeof (struct record)) == 0);
+
+  free (records);
+  free (sorted);
+}
+
+static uint64_t
+record_key (const void *px)
+{
+  /* Order-preserving: flip the sign bit. */
+  return ((uint64_t) (uint32_t) ((const struct record *) px)->key
+          ^ UINT64_C (0x80000000));
+}
+
+/* Records small enough to be merge sorted by copies of themselves. */
+struct small_record
+{
+  int key;
+  size_t serial;
+};
+
+static int
+small_record_cmp (const void *px, const void *py)
+{
+  const int x = ((const struct small_record *) px)->key;
+  const int y = ((const struct small_record *) py)->key;
+  return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
+
+static void
+test_large_disorderly_output (void)
+{
+  /* Random data is merge sorted, and an output this large is
+     streamed: by the last pass of the merge sort, for small records,
+     and by the copy out of the merge sort's records, for large
+     records with keys. */
+  const size_t n_small = (48 * 1024 * 1024) / sizeof (struct small_record);
+  struct small_record *small =
+    malloc (n_small * sizeof (struct small_record));
+  struct small_record *small_sorted =
+    malloc (n_small * sizeof (struct small_record));
+  for (size_t i = 0; i != n_small; i += 1)
+    {
+      small[i].key = random_int (0, 1000000);
+      small[i].serial = i;
+    }
+
+  patience_sort (small, n_small, sizeof (struct small_record),
+                 small_record_cmp, small_sorted);
+  for (size_t i = 1; i < n_small; i += 1)
+    {
+      CHECK (small_sorted[i - 1].key <= small_sorted[i].key);
+      if (small_sorted[i - 1].key == small_sorted[i].key)
+        CHECK (small_sorted[i - 1].serial < small_sorted[i].serial);
+    }
+
+  patience_sort_in_place (small, n_small, sizeof (struct small_record),
+                          small_record_cmp);
+  CHECK (memcmp (small, small_sorted,
+                 n_small * sizeof (struct small_record)) == 0);
+
+  free (small);
+  free (small_sorted);
+
+  const size_t n = 80000;
+  struct record *records = malloc (n * sizeof (struct record));
+  struct record *sorted = malloc (n * sizeof (struct record));
+  for (size_t i = 0; i != n; i += 1)
+    {
+      records[i].key = random_int (0, 1000000);
+      records[i].serial = i;
+      memset (records[i].padding, (int) (i & 0xFF),
+              sizeof records[i].padding);
+    }
+
+  patience_sort_keyed (records, n, sizeof (struct record), record_cmp,
+                       record_key, sorted);
+  check_records (n, sorted);
+  for (size_t i = 0; i != n; i += 1)
+    CHECK (sorted[i].padding[495] == (char) (sorted[i].serial & 0xFF));
+
+  patience_sort_in_place_keyed (records, n, sizeof (struct record),
+                                record_cmp, record_key);
+  CHECK (memcmp (records, sorted, n * sizeof (struct record)) == 0);
+
+  free (records);
+  free (sorted);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -278,5 +423,7 @@ main (int argc, char *argv[])
   (void) random_double ();
   (void) random_double ();
   test_stable_sort ();
+  test_large_output ();
+  test_large_disorderly_output ();
   return 0;
 }